@@ -40,6 +40,12 @@
 
 #include "Adafruit_RA8875.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 
 #ifdef _USE_FB0
 
@@ -1528,65 +1534,247 @@ void Adafruit_RA8875::plotfb (int16_t x, int16_t y, fbpix_t color)
             fb_canvas[index] = color;
 }
 
+/* the earth blend must not use fused multiply-add else results depend on the compiler and cpu
+ */
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC optimize ("fp-contract=off")
+#endif
+
+/* blend n pairs of day and night RGB565 pixels into c16 according to fract_day, 1 for all day, 0 for all night.
+ * this is the reference, blendEarthPixels() must produce exactly the same results.
+ */
+static void blendEarthPixelsScalar (const uint16_t *day_pix, const uint16_t *night_pix, const float *fract_day,
+uint16_t *c16, int n)
+{
+	for (int i = 0; i < n; i++) {
+	    float f_day = fract_day[i];
+	    if (f_day == 0) {
+		c16[i] = night_pix[i];
+	    } else if (f_day == 1) {
+		c16[i] = day_pix[i];
+	    } else {
+		uint8_t day_r = RGB565_R(day_pix[i]);
+		uint8_t day_g = RGB565_G(day_pix[i]);
+		uint8_t day_b = RGB565_B(day_pix[i]);
+		uint8_t night_r = RGB565_R(night_pix[i]);
+		uint8_t night_g = RGB565_G(night_pix[i]);
+		uint8_t night_b = RGB565_B(night_pix[i]);
+		float fract_night = 1 - f_day;
+		uint8_t twi_r = (f_day*day_r + fract_night*night_r);
+		uint8_t twi_g = (f_day*day_g + fract_night*night_g);
+		uint8_t twi_b = (f_day*day_b + fract_night*night_b);
+		c16[i] = RGB565 (twi_r, twi_g, twi_b);
+	    }
+	}
+}
+
+/* same as blendEarthPixelsScalar() but several pixels at once using SSE2 or NEON if available.
+ * RGB565_R/G/B are done exactly with integer math, eg 255*r/31 == 8*r + 7*r/31, and the blend is the same
+ * float multiply-add so results are identical. Pure day or night blends back to the original pixel.
+ */
+static void blendEarthPixels (const uint16_t *day_pix, const uint16_t *night_pix, const float *fract_day,
+uint16_t *c16, int n)
+{
+	int i = 0;
+
+#if defined(__SSE2__)
+
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i mask5 = _mm_set1_epi16 (0x1F);
+	const __m128i mask6 = _mm_set1_epi16 (0x3F);
+	const __m128i div31 = _mm_set1_epi16 (2115);            // y*2115>>16 == y/31 for y <= 7*31
+	const __m128i div21 = _mm_set1_epi16 (3121);            // y*3121>>16 == y/21 for y <= 63
+	const __m128i seven = _mm_set1_epi16 (7);
+	const __m128 one = _mm_set1_ps (1.0F);
+
+	// expand a 5 or 6 bit component to 8 bits, ie RGB565_R/G/B
+	#define SSE_EXP5(c5) _mm_add_epi16 (_mm_slli_epi16 (c5, 3), _mm_mulhi_epu16 (_mm_mullo_epi16 (c5, seven), div31))
+	#define SSE_EXP6(c6) _mm_add_epi16 (_mm_slli_epi16 (c6, 2), _mm_mulhi_epu16 (c6, div21))
+
+	// blend 8 day and night 8 bit components into 8 epi16
+	#define SSE_BLEND(d8,n8) _mm_packs_epi32 (                                                     \
+	    _mm_cvttps_epi32 (_mm_add_ps (_mm_mul_ps (fd_lo, _mm_cvtepi32_ps (_mm_unpacklo_epi16 (d8, zero))),  \
+					  _mm_mul_ps (fn_lo, _mm_cvtepi32_ps (_mm_unpacklo_epi16 (n8, zero))))),\
+	    _mm_cvttps_epi32 (_mm_add_ps (_mm_mul_ps (fd_hi, _mm_cvtepi32_ps (_mm_unpackhi_epi16 (d8, zero))),  \
+					  _mm_mul_ps (fn_hi, _mm_cvtepi32_ps (_mm_unpackhi_epi16 (n8, zero))))))
+
+	for (; i + 8 <= n; i += 8) {
+	    __m128i day = _mm_loadu_si128 ((const __m128i *)&day_pix[i]);
+	    __m128i night = _mm_loadu_si128 ((const __m128i *)&night_pix[i]);
+	    __m128 fd_lo = _mm_loadu_ps (&fract_day[i]);
+	    __m128 fd_hi = _mm_loadu_ps (&fract_day[i+4]);
+	    __m128 fn_lo = _mm_sub_ps (one, fd_lo);
+	    __m128 fn_hi = _mm_sub_ps (one, fd_hi);
+
+	    __m128i day_r = SSE_EXP5 (_mm_srli_epi16 (day, 11));
+	    __m128i day_g = SSE_EXP6 (_mm_and_si128 (_mm_srli_epi16 (day, 5), mask6));
+	    __m128i day_b = SSE_EXP5 (_mm_and_si128 (day, mask5));
+	    __m128i night_r = SSE_EXP5 (_mm_srli_epi16 (night, 11));
+	    __m128i night_g = SSE_EXP6 (_mm_and_si128 (_mm_srli_epi16 (night, 5), mask6));
+	    __m128i night_b = SSE_EXP5 (_mm_and_si128 (night, mask5));
+
+	    __m128i twi_r = SSE_BLEND (day_r, night_r);
+	    __m128i twi_g = SSE_BLEND (day_g, night_g);
+	    __m128i twi_b = SSE_BLEND (day_b, night_b);
+
+	    // RGB565
+	    __m128i twi = _mm_or_si128 (_mm_or_si128 (
+			    _mm_slli_epi16 (_mm_and_si128 (twi_r, _mm_set1_epi16 (0xF8)), 8),
+			    _mm_slli_epi16 (_mm_and_si128 (twi_g, _mm_set1_epi16 (0xFC)), 3)),
+			    _mm_srli_epi16 (twi_b, 3));
+	    _mm_storeu_si128 ((__m128i *)&c16[i], twi);
+	}
+
+	#undef SSE_EXP5
+	#undef SSE_EXP6
+	#undef SSE_BLEND
+
+#elif defined(__ARM_NEON)
+
+	const float32x4_t one = vdupq_n_f32 (1.0F);
+
+	// expand a 5 or 6 bit component to 8 bits, ie RGB565_R/G/B: 255*c*33826>>20 == 255*c/31 etc
+	#define NEON_EXP5(c5) vshrq_n_u32 (vmulq_n_u32 (c5, 255*33826), 20)
+	#define NEON_EXP6(c6) vshrq_n_u32 (vmulq_n_u32 (c6, 255*16645), 20)
+
+	// blend 4 day and night 8 bit components, use separate mul and add to match scalar rounding
+	#define NEON_BLEND(d8,n8) vcvtq_u32_f32 (vaddq_f32 (vmulq_f32 (fd, vcvtq_f32_u32 (d8)),       \
+							 vmulq_f32 (fn, vcvtq_f32_u32 (n8))))
+
+	for (; i + 4 <= n; i += 4) {
+	    uint32x4_t day = vmovl_u16 (vld1_u16 (&day_pix[i]));
+	    uint32x4_t night = vmovl_u16 (vld1_u16 (&night_pix[i]));
+	    float32x4_t fd = vld1q_f32 (&fract_day[i]);
+	    float32x4_t fn = vsubq_f32 (one, fd);
+
+	    uint32x4_t day_r = NEON_EXP5 (vshrq_n_u32 (day, 11));
+	    uint32x4_t day_g = NEON_EXP6 (vandq_u32 (vshrq_n_u32 (day, 5), vdupq_n_u32 (0x3F)));
+	    uint32x4_t day_b = NEON_EXP5 (vandq_u32 (day, vdupq_n_u32 (0x1F)));
+	    uint32x4_t night_r = NEON_EXP5 (vshrq_n_u32 (night, 11));
+	    uint32x4_t night_g = NEON_EXP6 (vandq_u32 (vshrq_n_u32 (night, 5), vdupq_n_u32 (0x3F)));
+	    uint32x4_t night_b = NEON_EXP5 (vandq_u32 (night, vdupq_n_u32 (0x1F)));
+
+	    uint32x4_t twi_r = NEON_BLEND (day_r, night_r);
+	    uint32x4_t twi_g = NEON_BLEND (day_g, night_g);
+	    uint32x4_t twi_b = NEON_BLEND (day_b, night_b);
+
+	    // RGB565
+	    uint32x4_t twi = vorrq_u32 (vorrq_u32 (
+			    vshlq_n_u32 (vandq_u32 (twi_r, vdupq_n_u32 (0xF8)), 8),
+			    vshlq_n_u32 (vandq_u32 (twi_g, vdupq_n_u32 (0xFC)), 3)),
+			    vshrq_n_u32 (twi_b, 3));
+	    vst1_u16 (&c16[i], vmovn_u32 (twi));
+	}
+
+	#undef NEON_EXP5
+	#undef NEON_EXP6
+	#undef NEON_BLEND
+
+#endif
+
+	// finish any remainder
+	blendEarthPixelsScalar (&day_pix[i], &night_pix[i], &fract_day[i], &c16[i], n - i);
+}
+
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT DEFAULT
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+
 /* plot hi res earth lat0,lng0 at app's screen location x0,y0.
  * we interpolate this to SCALESZxSCALESZ, knowing dlat and dlng going one full step right and down.
  * frac_day is 1 for all DEARTH, 0 for all NEARTH else blend
  */
 void Adafruit_RA8875::plotEarth (uint16_t x0, uint16_t y0, float lat0, float lng0,
 float dlatr, float dlngr, float dlatd, float dlngd, float fract_day)
+{
+        EarthPix ep;
+        ep.lat0 = lat0;
+        ep.lng0 = lng0;
+        ep.dlatr = dlatr;
+        ep.dlngr = dlngr;
+        ep.dlatd = dlatd;
+        ep.dlngd = dlngd;
+        ep.fract_day = fract_day;
+        plotEarthSpan (x0, y0, 1, &ep);
+}
+
+/* plot n hi res earth pixels starting at app's screen location x0,y0 and proceeding right.
+ * each is interpolated to SCALESZxSCALESZ as described by plotEarth(), then each full res row is
+ * blended all at once.
+ */
+void Adafruit_RA8875::plotEarthSpan (uint16_t x0, uint16_t y0, int n, const EarthPix *ep)
 {
         // beware of no map files
         if (!DEARTH_BIG || !NEARTH_BIG)
             return;
 
-        // beware lng wrap across date line
-        if (dlngr < -180) dlngr += 360;
-        if (dlngd < -180) dlngd += 360;
-        if (dlngr >  180) dlngr -= 360;
-        if (dlngd >  180) dlngd -= 360;
-
-        // scale app step size to our step size
-        dlatr /= SCALESZ;
-        dlngr /= SCALESZ;
-        dlatd /= SCALESZ;
-        dlngd /= SCALESZ;
-
         // ditto starting loc
 	x0 *= SCALESZ;
 	y0 *= SCALESZ;
 
+        // clip to one full res row
+        if (x0 + n*SCALESZ > FB_XRES)
+            n = (FB_XRES - x0)/SCALESZ;
+        if (n <= 0 || y0 + SCALESZ > FB_YRES)
+            return;
+        int nsub = n*SCALESZ;
+
+        // full res row of pixels to be blended
+        uint16_t day_pix[FB_XRES];
+        uint16_t night_pix[FB_XRES];
+        float fract_day[FB_XRES];
+        uint16_t c16[FB_XRES];
+
 	for (int r = 0; r < SCALESZ; r++) {
+
+            // collect each map pixel, only looking up the other if blending
+            int i = 0;
+            for (int k = 0; k < n; k++) {
+                const EarthPix &e = ep[k];
+
+                // beware lng wrap across date line
+                float dlngr = e.dlngr, dlngd = e.dlngd;
+                if (dlngr < -180) dlngr += 360;
+                if (dlngd < -180) dlngd += 360;
+                if (dlngr >  180) dlngr -= 360;
+                if (dlngd >  180) dlngd -= 360;
+
+                // scale app step size to our step size
+                float dlatr = e.dlatr / SCALESZ;
+                dlngr /= SCALESZ;
+                float dlatd = e.dlatd / SCALESZ;
+                dlngd /= SCALESZ;
+
+                for (int c = 0; c < SCALESZ; c++) {
+                    float lat = e.lat0 + dlatr*c + dlatd*r;
+                    float lng = e.lng0 + dlngr*c + dlngd*r;
+                    int ex = (int)((lng+180)*EARTH_BIG_W/360 + EARTH_BIG_W + 0.5F);
+                    int ey = (int)((90-lat)*EARTH_BIG_H/180 + EARTH_BIG_H + 0.5F);
+                    ex = (ex + EARTH_BIG_W) % EARTH_BIG_W;
+                    ey = (ey + EARTH_BIG_H) % EARTH_BIG_H;
+                    if (e.fract_day == 0) {
+                        day_pix[i] = night_pix[i] = EPIXEL(NEARTH_BIG,ey,ex);
+                    } else if (e.fract_day == 1) {
+                        day_pix[i] = night_pix[i] = EPIXEL(DEARTH_BIG,ey,ex);
+                    } else {
+                        day_pix[i] = EPIXEL(DEARTH_BIG,ey,ex);
+                        night_pix[i] = EPIXEL(NEARTH_BIG,ey,ex);
+                    }
+                    fract_day[i] = e.fract_day;
+                    i++;
+                }
+            }
+
+            // blend and store
+            blendEarthPixels (day_pix, night_pix, fract_day, c16, nsub);
 	    fbpix_t *frow = &fb_canvas[(y0+r)*FB_XRES + x0];
-	    for (int c = 0; c < SCALESZ; c++) {
-                float lat = lat0 + dlatr*c + dlatd*r;
-                float lng = lng0 + dlngr*c + dlngd*r;
-                int ex = (int)((lng+180)*EARTH_BIG_W/360 + EARTH_BIG_W + 0.5F);
-                int ey = (int)((90-lat)*EARTH_BIG_H/180 + EARTH_BIG_H + 0.5F);
-                ex = (ex + EARTH_BIG_W) % EARTH_BIG_W;
-                ey = (ey + EARTH_BIG_H) % EARTH_BIG_H;
-		uint16_t c16; 
-		if (fract_day == 0) {
-		    c16 = EPIXEL(NEARTH_BIG,ey,ex);
-		} else if (fract_day == 1) {
-		    c16 = EPIXEL(DEARTH_BIG,ey,ex);
-		} else {
-		    // blend from day to night
-		    uint16_t day_pix = EPIXEL(DEARTH_BIG,ey,ex);
-		    uint16_t night_pix = EPIXEL(NEARTH_BIG,ey,ex);
-		    uint8_t day_r = RGB565_R(day_pix);
-		    uint8_t day_g = RGB565_G(day_pix);
-		    uint8_t day_b = RGB565_B(day_pix);
-		    uint8_t night_r = RGB565_R(night_pix);
-		    uint8_t night_g = RGB565_G(night_pix);
-		    uint8_t night_b = RGB565_B(night_pix);
-		    float fract_night = 1 - fract_day;
-		    uint8_t twi_r = (fract_day*day_r + fract_night*night_r);
-		    uint8_t twi_g = (fract_day*day_g + fract_night*night_g);
-		    uint8_t twi_b = (fract_day*day_b + fract_night*night_b);
-		    c16 = RGB565 (twi_r, twi_g, twi_b);
-		}
-		*frow++ = RGB16TOFBPIX(c16);
-	    }
+            for (i = 0; i < nsub; i++)
+                frow[i] = RGB16TOFBPIX(c16[i]);
 	}
 }
 
@@ -2787,3 +2975,57 @@ void Adafruit_RA8875::getScreenSize (int *w, int *h)
 }
 
 #endif // _USE_FB0
+
+
+
+#if defined(_UNIT_TEST)
+
+/* g++ -Wall -O2 -IArduinoLib -D_WEB_ONLY -D_UNIT_TEST -pthread ArduinoLib/Adafruit_RA8875.cpp \
+ *      ArduinoLib/CourierPrimeSans6.cpp && ./a.out
+ * confirm blendEarthPixels() matches blendEarthPixelsScalar() exactly.
+ * no output other than the summary unless they differ.
+ */
+
+int main (int ac, char *av[])
+{
+        // one row of every day pixel against a pseudo-random night pixel and blend
+        const int n = 1<<16;
+        static uint16_t day_pix[n], night_pix[n], ref[n], fast[n];
+        static float fract_day[n];
+
+        int n_bad = 0;
+        srand (1);
+        for (int trial = 0; trial < 200; trial++) {
+            for (int i = 0; i < n; i++) {
+                day_pix[i] = i;
+                night_pix[i] = rand() & 0xFFFF;
+                switch (rand() % 8) {
+                case 0:  fract_day[i] = 0; break;
+                case 1:  fract_day[i] = 1; break;
+                default: fract_day[i] = (float)rand()/RAND_MAX; break;
+                }
+            }
+
+            // use an odd length to exercise the scalar remainder too
+            blendEarthPixelsScalar (day_pix, night_pix, fract_day, ref, n-3);
+            blendEarthPixels (day_pix, night_pix, fract_day, fast, n-3);
+
+            for (int i = 0; i < n-3; i++) {
+                if (ref[i] != fast[i] && n_bad++ < 20)
+                    printf ("day %04X night %04X fract %.9g: ref %04X fast %04X\n", day_pix[i],
+                                    night_pix[i], fract_day[i], ref[i], fast[i]);
+            }
+        }
+
+        #if defined(__SSE2__)
+            const char *how = "SSE2";
+        #elif defined(__ARM_NEON)
+            const char *how = "NEON";
+        #else
+            const char *how = "scalar";
+        #endif
+        printf ("%s: %d mismatches\n", how, n_bad);
+        return (n_bad != 0);
+}
+
+#endif // _UNIT_TEST
@@ -191,6 +191,15 @@ class Adafruit_RA8875 {
 	void plotEarth (uint16_t x0, uint16_t y0, float lat0, float lng0,
             float dlatr, float dlngr, float dlatd, float dlngd, float fract_day);
 
+        // same but for a run of app pixels along one row, each described by one EarthPix
+        typedef struct {
+            float lat0, lng0;                   // location at this app pixel, degs
+            float dlatr, dlngr;                 // change going one app pixel right, degs
+            float dlatd, dlngd;                 // change going one app pixel down, degs
+            float fract_day;                    // 1 for all day, 0 for all night else blend
+        } EarthPix;
+	void plotEarthSpan (uint16_t x0, uint16_t y0, int n, const EarthPix *ep);
+
         // methods to implement a protected rectangle drawn only with drawPR()
         void setPR (uint16_t x, uint16_t y, uint16_t w, uint16_t h);
         void drawPR(void);
@@ -9,35 +9,132 @@
 // set for more verbose info
 static int _trace_client = 0;
 
+// reply body decoding states
+typedef enum {
+        HB_NONE,                        // no framing, body ends at EOF
+        HB_DATA,                        // body_left more bytes of body or chunk
+        HB_CHUNKSZ,                     // reading hex chunk size
+        HB_CHUNKEXT,                    // skipping chunk extension to end of line
+        HB_CHUNKEND,                    // skipping CRLF after chunk data
+        HB_TRAILER,                     // skipping trailer lines after last chunk
+        HB_DONE,                        // body complete
+} BodyState;
+
+/* idle keep-alive connections available for reuse by connect().
+ * servers commonly drop idle connections after 5 seconds so we don't keep them as long as that.
+ */
+#define KA_NPOOL        4               // max idle connections
+#define KA_MAXIDLE      4               // max seconds idle before we consider it closed
+typedef struct {
+        int fd;                         // socket, or -1 if slot unused
+        char host[64];                  // host as given to connect()
+        int port;                       // port as given to connect()
+        time_t t0;                      // time() when parked
+} KAConn;
+static KAConn ka_pool[KA_NPOOL] = {{-1}, {-1}, {-1}, {-1}};
+static pthread_mutex_t ka_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* save fd for reuse with host:port, return whether there was room.
+ */
+static bool parkSocket (int fd, const char *host, int port)
+{
+        bool ok = false;
+        pthread_mutex_lock (&ka_lock);
+        time_t now = time(NULL);
+        for (int i = 0; i < KA_NPOOL; i++) {
+            KAConn *kp = &ka_pool[i];
+            if (kp->fd >= 0 && now - kp->t0 > KA_MAXIDLE) {
+                close (kp->fd);
+                kp->fd = -1;
+            }
+            if (!ok && kp->fd < 0) {
+                kp->fd = fd;
+                snprintf (kp->host, sizeof(kp->host), "%s", host);
+                kp->port = port;
+                kp->t0 = now;
+                ok = true;
+            }
+        }
+        pthread_mutex_unlock (&ka_lock);
+        if (ok && _trace_client)
+            printf ("WiFiCl: parked fd %d for %s:%d\n", fd, host, port);
+        return (ok);
+}
+
+/* return an idle connection to host:port that still looks open, else -1.
+ */
+static int unparkSocket (const char *host, int port)
+{
+        int fd = -1;
+        pthread_mutex_lock (&ka_lock);
+        time_t now = time(NULL);
+        for (int i = 0; fd < 0 && i < KA_NPOOL; i++) {
+            KAConn *kp = &ka_pool[i];
+            if (kp->fd < 0 || kp->port != port || strcmp (kp->host, host) != 0)
+                continue;
+
+            // claim if not too old and nothing has arrived, which could only be EOF or junk
+            fd_set rset;
+            FD_ZERO (&rset);
+            FD_SET (kp->fd, &rset);
+            struct timeval tv = {0, 0};
+            if (now - kp->t0 <= KA_MAXIDLE && select (kp->fd+1, &rset, NULL, NULL, &tv) == 0)
+                fd = kp->fd;
+            else
+                close (kp->fd);
+            kp->fd = -1;
+        }
+        pthread_mutex_unlock (&ka_lock);
+        if (fd >= 0 && _trace_client)
+            printf ("WiFiCl: reusing fd %d for %s:%d\n", fd, host, port);
+        return (fd);
+}
+
 // default constructor
 WiFiClient::WiFiClient()
 {
-        // init
-	socket = -1;
-	n_peek = 0;
-        next_peek = 0;
+        initState (-1);
+        capturing = false;
+        cap_buf = NULL;
+        cap_n = cap_sz = 0;
 }
 
 // constructor handed an open socket to use
 WiFiClient::WiFiClient(int fd)
 {
-        // init
-	socket = -1;
-	n_peek = 0;
-        next_peek = 0;
-
         if (fd >= 0 && _trace_client)
             printf ("WiFiCl: new WiFiClient inheriting fd %d\n", fd);
 
+        initState (fd);
+        capturing = false;
+        cap_buf = NULL;
+        cap_n = cap_sz = 0;
+}
+
+/* init all connection state to use the given socket, which may be -1
+ */
+void WiFiClient::initState (int fd)
+{
 	socket = fd;
 	n_peek = 0;
         next_peek = 0;
+        host[0] = '\0';
+        port = 0;
+        reused = false;
+        http_reply = false;
+        got_reply = false;
+        keep_alive = false;
+        chunked = false;
+        body_state = HB_NONE;
+        body_left = 0;
+        trailer_len = 0;
+        n_replay = 0;
 }
 
 // return whether this socket is active
 WiFiClient::operator bool()
 {
-        bool is_active = socket != -1;
+        bool is_active = socket != -1 || capturing;
         if (_trace_client && is_active)
             printf ("WiFiCl: fd %d is active\n", socket);
 	return (is_active);
@@ -105,7 +202,9 @@ int WiFiClient::tout (int to_ms, int fd)
 }
 
 
-bool WiFiClient::connect(const char *host, int port)
+/* open a new connection to host:port, return socket or -1
+ */
+int WiFiClient::openSocket (const char *host, int port)
 {
         struct addrinfo hints, *aip;
         char port_str[16];
@@ -121,7 +220,7 @@ bool WiFiClient::connect(const char *host, int port)
         int error = ::getaddrinfo (host, port_str, &hints, &aip);
         if (error) {
             printf ("WiFiCl: getaddrinfo(%s:%d): %s\n", host, port, gai_strerror(error));
-            return (false);
+            return (-1);
         }
 
         /* create socket */
@@ -129,7 +228,7 @@ bool WiFiClient::connect(const char *host, int port)
         if (sockfd < 0) {
             freeaddrinfo (aip);
             printf ("WiFiCl: socket(%s:%d): %s\n", host, port, strerror(errno));
-	    return (false);
+	    return (-1);
         }
 
         /* connect */
@@ -137,7 +236,7 @@ bool WiFiClient::connect(const char *host, int port)
             printf ("WiFiCl: connect(%s:%d): %s\n", host, port, strerror(errno));
             freeaddrinfo (aip);
             close (sockfd);
-            return (false);
+            return (-1);
         }
 
         /* handle write errors inline */
@@ -147,9 +246,26 @@ bool WiFiClient::connect(const char *host, int port)
         if (_trace_client)
             printf ("WiFiCl: new %s:%d fd %d\n", host, port, sockfd);
         freeaddrinfo (aip);
-	socket = sockfd;
-	n_peek = 0;
-        next_peek = 0;
+        return (sockfd);
+}
+
+bool WiFiClient::connect(const char *host, int port)
+{
+        /* reuse an idle keep-alive connection if possible, else open a new one */
+        bool was_parked = true;
+        int sockfd = unparkSocket (host, port);
+        if (sockfd < 0) {
+            sockfd = openSocket (host, port);
+            if (sockfd < 0)
+                return (false);
+            was_parked = false;
+        }
+
+        /* ok */
+        initState (sockfd);
+        snprintf (this->host, sizeof(this->host), "%s", host);
+        this->port = port;
+        reused = was_parked;
         return (true);
 }
 
@@ -171,46 +287,50 @@ void WiFiClient::setNoDelay(bool on)
 void WiFiClient::stop()
 {
 	if (socket >= 0) {
+            // save for reuse if server will keep it open and we read exactly all of the last reply
+            if (keep_alive && body_state == HB_DONE && next_peek == n_peek
+                                                        && parkSocket (socket, host, port)) {
+                initState (-1);
+                return;
+            }
             if (_trace_client)
                 printf ("WiFiCl: fd %d is now closed\n", socket);
 	    shutdown (socket, SHUT_RDWR);
 	    close (socket);
-	    socket = -1;
-	    n_peek = 0;
-            next_peek = 0;
+	    initState (-1);
 	}
 }
 
+/* N.B. reports false after the end of an HTTP reply body so readers stop there even if kept alive
+ */
 bool WiFiClient::connected()
 {
-	return (socket >= 0);
+	return ((socket >= 0 && body_state != HB_DONE) || capturing);
 }
 
-int WiFiClient::available()
+/* read more from socket into peek[], waiting up to to_ms if none are ready now.
+ * call only when all of peek[] has been consumed.
+ * return whether any arrived; if socket reached EOF or failed it is also closed.
+ * N.B. if a reused keep-alive socket turns out to have been closed by the server before any reply,
+ *      we transparently reconnect and resend the request.
+ */
+bool WiFiClient::fillPeek (int to_ms)
 {
-        // none if closed
-        if (socket < 0)
-            return (0);
-
-        // simple if unread bytes already available
-	if (next_peek < n_peek)
-	    return (1);
-
-        // don't block if nothing available
+        // wait for something to read
         struct timeval tv;
         fd_set rset;
         FD_ZERO (&rset);
         FD_SET (socket, &rset);
-        tv.tv_sec = 0;
-        tv.tv_usec = 0;
+        tv.tv_sec = to_ms/1000;
+        tv.tv_usec = 1000*(to_ms%1000);
         int s = select (socket+1, &rset, NULL, NULL, &tv);
         if (s < 0) {
             printf ("WiFiCl: fd %d select err: %s\n", socket, strerror(errno));
 	    stop();
-	    return (0);
+	    return (false);
 	}
         if (s == 0)
-            return (0);
+            return (false);
 
         // read more
 	int nr = ::read(socket, peek, sizeof(peek));
@@ -219,27 +339,257 @@ int WiFiClient::available()
                 printf ("WiFiCl: read(%d) %d\n", socket, nr);
 	    n_peek = nr;
             next_peek = 0;
-	    return (1);
-	} else {
-            if (nr == 0) {
-                if (_trace_client)
-                    printf ("WiFiCl: read(%d) EOF\n", socket);
-            } else
-                printf ("WiFiCl: read(%d): %s\n", socket, strerror(errno));
-	    stop();
-	    return (0);
+            got_reply = true;
+	    return (true);
 	}
+
+        // try again on a fresh connection if server had already given up on a reused one
+        if (resendRequest())
+            return (fillPeek (to_ms));
+
+        if (nr == 0) {
+            if (_trace_client)
+                printf ("WiFiCl: read(%d) EOF\n", socket);
+        } else
+            printf ("WiFiCl: read(%d): %s\n", socket, strerror(errno));
+        stop();
+        return (false);
+}
+
+/* if socket was reused from the keep-alive pool and the request we have sent so far has not been
+ * answered, replace socket with a fresh connection and resend the request.
+ * return whether this was possible; if not, socket is left as is.
+ */
+bool WiFiClient::resendRequest()
+{
+        if (!reused || !http_reply || got_reply || n_replay <= 0)
+            return (false);
+
+        if (_trace_client)
+            printf ("WiFiCl: reused fd %d is stale, reconnecting\n", socket);
+        int fd = openSocket (host, port);
+        if (fd < 0)
+            return (false);
+        close (socket);
+        socket = fd;
+        reused = false;
+        return (write ((uint8_t *)replay, n_replay) == n_replay);
+}
+
+/* advance over any chunked framing in peek[] and return whether body bytes are ready at next_peek.
+ */
+bool WiFiClient::bodyReady()
+{
+        while (next_peek < n_peek) {
+            if (body_state == HB_NONE || body_state == HB_DATA)
+                return (true);
+            if (body_state == HB_DONE)
+                return (false);
+
+            char c = peek[next_peek++];
+            switch (body_state) {
+            case HB_CHUNKSZ:
+                if (isxdigit(c))
+                    body_left = 16*body_left + (isdigit(c) ? c - '0' : tolower(c) - 'a' + 10);
+                else if (c != '\n')
+                    body_state = HB_CHUNKEXT;
+                if (c != '\n')
+                    break;
+                // fallthru
+            case HB_CHUNKEXT:
+                if (c == '\n') {
+                    if (body_left > 0)
+                        body_state = HB_DATA;
+                    else {
+                        body_state = HB_TRAILER;
+                        trailer_len = 0;
+                    }
+                }
+                break;
+            case HB_CHUNKEND:
+                if (c == '\n') {
+                    body_state = HB_CHUNKSZ;
+                    body_left = 0;
+                }
+                break;
+            case HB_TRAILER:
+                if (c == '\n') {
+                    if (trailer_len == 0)
+                        body_state = HB_DONE;
+                    trailer_len = 0;
+                } else if (c != '\r')
+                    trailer_len++;
+                break;
+            default:
+                break;
+            }
+        }
+        return (false);
+}
+
+/* record that n bytes of body at next_peek have been consumed
+ */
+void WiFiClient::consumeBody (int n)
+{
+        next_peek += n;
+        if (body_state == HB_DATA && (body_left -= n) == 0)
+            body_state = chunked ? HB_CHUNKEND : HB_DONE;
+}
+
+int WiFiClient::available()
+{
+        // none if closed or at end of reply
+        if (socket < 0 || body_state == HB_DONE)
+            return (0);
+
+        // simple if unread body bytes already available, else read more if ready now
+        while (!bodyReady()) {
+            if (body_state == HB_DONE || !fillPeek (0))
+                return (0);
+        }
+        return (1);
 }
 
 int WiFiClient::read()
 {
-	if (available())
-            return (peek[next_peek++]);
+	if (available()) {
+            int c = peek[next_peek];
+            consumeBody (1);
+            return (c);
+        }
 	return (-1);
 }
 
+/* read up to n bytes that are available now into buf, return count which may be 0.
+ */
+int WiFiClient::read (uint8_t *buf, size_t n)
+{
+        size_t n_read = 0;
+        while (n_read < n && available()) {
+            size_t n_more = n_peek - next_peek;
+            if (body_state == HB_DATA && n_more > (size_t)body_left)
+                n_more = body_left;
+            if (n_more > n - n_read)
+                n_more = n - n_read;
+            memcpy (buf + n_read, &peek[next_peek], n_more);
+            consumeBody (n_more);
+            n_read += n_more;
+        }
+        return (n_read);
+}
+
+/* non-standard: wait up to to_ms for available() to become true, return whether it did.
+ */
+bool WiFiClient::waitAvailable (int to_ms)
+{
+        uint32_t t0 = millis();
+        while (!available()) {
+            int ms_left = to_ms - (int)(millis() - t0);
+            if (socket < 0 || body_state == HB_DONE || ms_left <= 0 || !fillPeek (ms_left))
+                return (false);
+        }
+        return (true);
+}
+
+/* non-standard: read next line into line[], waiting up to to_ms between arrivals.
+ * line[] will have \r and \n removed and end with \0; it is silently truncated if longer than line_len.
+ * return length of line not including \0, else -1 if no complete line.
+ */
+int WiFiClient::readLine (char line[], int line_len, int to_ms)
+{
+        int ll = 0;
+        line_len -= 1;                          // room for EOS
+        while (waitAvailable (to_ms)) {
+            int n_more = n_peek - next_peek;
+            if (body_state == HB_DATA && n_more > body_left)
+                n_more = body_left;
+            uint8_t *nl = (uint8_t *) memchr (&peek[next_peek], '\n', n_more);
+            int n_use = nl ? nl - &peek[next_peek] : n_more;
+            for (int i = 0; i < n_use; i++) {
+                char c = peek[next_peek+i];
+                if (c != '\r' && ll < line_len)
+                    line[ll++] = c;
+            }
+            consumeBody (nl ? n_use + 1 : n_use);
+            if (nl) {
+                line[ll] = '\0';
+                return (ll);
+            }
+        }
+        return (-1);
+}
+
+/* non-standard: call before sending an HTTP request so we can resend it if a reused keep-alive
+ * connection turns out to be stale.
+ */
+void WiFiClient::beginHTTPRequest()
+{
+        http_reply = true;
+        got_reply = false;
+        keep_alive = false;
+        chunked = false;
+        body_state = HB_NONE;
+        n_replay = 0;
+}
+
+/* non-standard: call after reading the HTTP reply header of a request started with beginHTTPRequest()
+ * to set how the body is framed: content_length < 0 means unknown. Thereafter reads stop at the
+ * end of the body, and connected() reports false, so stop() can save the connection for reuse
+ * by connect() if keep_alive.
+ * N.B. harmless no-op on connections without beginHTTPRequest() such as those from WiFiServer.
+ */
+void WiFiClient::beginHTTPBody (long content_length, bool is_chunked, bool ka)
+{
+        if (!http_reply)
+            return;
+        http_reply = false;
+
+        chunked = is_chunked;
+        if (chunked) {
+            body_state = HB_CHUNKSZ;
+            body_left = 0;
+        } else if (content_length > 0) {
+            body_state = HB_DATA;
+            body_left = content_length;
+        } else if (content_length == 0) {
+            body_state = HB_DONE;
+        } else {
+            body_state = HB_NONE;               // only EOF can end this body
+            ka = false;
+        }
+        keep_alive = ka;
+}
+
 int WiFiClient::write (const uint8_t *buf, int n)
 {
+        // save request in case we need to resend it on a fresh connection
+        if (reused && http_reply && !got_reply && n_replay >= 0) {
+            if (n_replay + n <= (int)sizeof(replay)) {
+                memcpy (replay + n_replay, buf, n);
+                n_replay += n;
+            } else
+                n_replay = -1;
+        }
+
+        // just collect if capturing
+        if (capturing) {
+            if (cap_n + n > cap_sz) {
+                size_t new_sz = cap_sz ? 2*cap_sz : 4096;
+                while (new_sz < cap_n + n)
+                    new_sz *= 2;
+                char *new_buf = (char *) realloc (cap_buf, new_sz);
+                if (!new_buf) {
+                    printf ("WiFiCl: no memory to capture %d more bytes\n", n);
+                    return (0);
+                }
+                cap_buf = new_buf;
+                cap_sz = new_sz;
+            }
+            memcpy (cap_buf + cap_n, buf, n);
+            cap_n += n;
+            return (n);
+        }
+
         // can't if closed
         if (socket < 0)
             return (0);
@@ -250,6 +600,8 @@ int WiFiClient::write (const uint8_t *buf, int n)
 	    if (nw < 0) {
                 // select says it won't block but it still might be temporarily EAGAIN
                 if (errno != EAGAIN) {
+                    if (resendRequest())
+                        return (n);
                     printf ("WiFiCl: write(%d): %s\n", socket, strerror(errno));
                     stop();             // avoid repeated failed attempts
                     return (0);
@@ -352,16 +704,40 @@ void WiFiClient::println (uint32_t i)
 	write ((const uint8_t *) buf, n);
 }
 
+/* non-standard: start or stop collecting all subsequent output in memory instead of sending it.
+ * starting discards any previous capture not yet retrieved with getCapture().
+ * N.B. available() and read() find nothing while capturing.
+ */
+void WiFiClient::captureOutput (bool on)
+{
+        if (on) {
+            free (cap_buf);
+            cap_buf = NULL;
+            cap_n = cap_sz = 0;
+        }
+        capturing = on;
+}
+
+/* non-standard: hand over the malloced buffer of all output collected so far, its length in n.
+ * N.B. caller must free() the result, which may be NULL if nothing was collected.
+ */
+char *WiFiClient::getCapture (size_t &n)
+{
+        char *buf = cap_buf;
+        n = cap_n;
+        cap_buf = NULL;
+        cap_n = cap_sz = 0;
+        return (buf);
+}
+
 IPAddress WiFiClient::remoteIP()
 {
 	struct sockaddr_in sa;
 	socklen_t len = sizeof(sa);
 
+	// N.B. avoid inet_ntoa() so this is safe to use from several threads
+	memset (&sa, 0, sizeof(sa));
 	getpeername(socket, (struct sockaddr *)&sa, &len);
-	struct in_addr ip_addr = sa.sin_addr;
-
-	char *s = inet_ntoa (ip_addr);
-        int oct0, oct1, oct2, oct3;
-        sscanf (s, "%d.%d.%d.%d", &oct0, &oct1, &oct2, &oct3);
-	return (IPAddress(oct0,oct1,oct2,oct3));
+	uint32_t ip = ntohl (sa.sin_addr.s_addr);
+	return (IPAddress((ip>>24)&0xff, (ip>>16)&0xff, (ip>>8)&0xff, ip&0xff));
 }
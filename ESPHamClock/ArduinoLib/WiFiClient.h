@@ -43,6 +43,7 @@ class WiFiClient {
         void setNoDelay(bool on);
 	bool connected();
 	int read();
+	int read (uint8_t *buf, size_t n);
 	operator bool();
 	int write (const uint8_t *buf, int n);
 	void print (void);
@@ -60,16 +61,51 @@ class WiFiClient {
 	void flush(void){};
 	IPAddress remoteIP(void);
 
+        // non-standard: collect all output in memory instead of writing to a socket
+        void captureOutput (bool on);
+        char *getCapture (size_t &n);
+
+        // non-standard: blocking reads
+        bool waitAvailable (int to_ms);
+        int readLine (char line[], int line_len, int to_ms);
+
+        // non-standard: HTTP/1.1 reply body framing and keep-alive reuse of connections
+        void beginHTTPRequest (void);
+        void beginHTTPBody (long content_length, bool is_chunked, bool ka);
+
     private:
 
 	int socket;
-  	uint8_t peek[4096];             // read-ahead buffer
+  	uint8_t peek[16384];            // read-ahead buffer
   	int n_peek;                     // n useful values in peek[]
         int next_peek;                  // next peek[] index to use
 
+        char host[64];                  // host and port given to connect(), for keep-alive reuse
+        int port;
+        bool reused;                    // set if socket came from the keep-alive pool
+        bool http_reply;                // set from beginHTTPRequest() until reply body starts
+        bool got_reply;                 // set when any bytes arrive after beginHTTPRequest()
+        bool keep_alive;                // whether server will keep connection open after body
+        bool chunked;                   // whether body uses chunked transfer encoding
+        int body_state;                 // BodyState of reply body decoding
+        long body_left;                 // bytes left in body or current chunk
+        int trailer_len;                // length of current chunked trailer line
+        char replay[1024];              // request as sent on a reused socket, to resend if stale
+        int n_replay;                   // n used in replay[], or -1 if overflowed
+
+        bool capturing;                 // set while collecting output in cap_buf
+        char *cap_buf;                  // malloced output collected while capturing
+        size_t cap_n, cap_sz;           // n used and n malloced in cap_buf
+
 
         int connect_to (int sockfd, struct sockaddr *serv_addr, int addrlen, int to_ms);
         int tout (int to_ms, int fd);
+        int openSocket (const char *host, int port);
+        void initState (int fd);
+        bool fillPeek (int to_ms);
+        bool resendRequest (void);
+        bool bodyReady (void);
+        void consumeBody (int n);
 
 };
 
@@ -1864,7 +1864,7 @@ static bool overMaidKey (const SCoord &s)
 
 /* return whether s is over the map globe, depending on the current projection.
  */
-static bool overActiveMap (const SCoord &s)
+bool overActiveMap (const SCoord &s)
 {
     switch ((MapProjection)map_proj) {
 
@@ -1913,11 +1913,18 @@ bool overMapScale (const SCoord &s)
     return (mapScaleIsUp() && inBox(s,mapscale_b));
 }
 
+/* return whether coordinate s is over any of the controls that are drawn on top of the map
+ */
+bool overMapOverlay (const SCoord &s)
+{
+    return (overRSS(s) || inBox(s,view_btn_b) || overMaidKey(s) || overMapScale(s));
+}
+
 /* return whether coordinate s is over a usable map location
  */
 bool overMap (const SCoord &s)
 {
-    return (overActiveMap(s) && !overRSS(s) && !inBox(s,view_btn_b) && !overMaidKey(s) && !overMapScale(s));
+    return (overActiveMap(s) && !overMapOverlay(s));
 }
 
 /* return whether box b is over a usable map location
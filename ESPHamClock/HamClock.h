@@ -547,6 +547,8 @@ extern void wdDelay(int ms);
 extern bool timesUp (uint32_t *prev, uint32_t dt);
 extern void setDXPathInvalid(void);
 extern const SCoord raw2appSCoord (const SCoord &s_raw);
+extern bool overActiveMap (const SCoord &s);
+extern bool overMapOverlay (const SCoord &s);
 extern bool overMap (const SCoord &s);
 extern bool overMap (const SBox &b);
 extern bool overRSS (const SCoord &s);
@@ -1516,6 +1518,22 @@ extern FS_Info *getConfigDirInfo (int *n_info, char **fs_name, uint64_t *fs_size
 
 
 
+/*********************************************************************************************
+ *
+ * mapzip.cpp
+ *
+ */
+
+#define HCZ_MAGIC       "HCZ1"                  // first 4 bytes of every compressed map file
+#define HCZ_HDRSZ       20                      // bytes in HCZ header proper: magic, w, h, band rows, n bands
+#define HCZ_BMPHDRSZ    122                     // bytes in original BMP header that follows
+
+extern int lz4Compress (const uint8_t *src, int src_n, uint8_t *dst, int dst_max);
+extern int lz4Decompress (const uint8_t *src, int src_n, uint8_t *dst, int dst_n);
+
+
+
+
 /*********************************************************************************************
  *
  * menu.cpp
@@ -2523,6 +2541,7 @@ extern void updateWiFi(void);
 extern bool checkBCTouch (const SCoord &s, const SBox &b);
 extern bool setPlotChoice (PlotPane new_pp, PlotChoice new_ch);
 extern bool getTCPChar (WiFiClient &client, char *cp);
+extern int getTCPBytes (WiFiClient &client, char *buf, int n);
 extern time_t getNTPUTC(const char **server);
 extern void scheduleRSSNow(void);
 extern bool getTCPLine (WiFiClient &client, char line[], uint16_t line_len, uint16_t *ll);
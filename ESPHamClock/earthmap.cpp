@@ -56,6 +56,10 @@ bool panzoom_pending;
 #define THETA_GRID      15
 #define FINESTEP_GRID   (1.0F/pan_zoom.zoom)
 
+#if defined(_IS_UNIX)
+static void drawMapRow (uint16_t y);
+#endif
+
 // establish GRIDC and GRIDC00
 static void getGridColorCache()
 {
@@ -1532,8 +1536,8 @@ void drawMoreEarth()
 #if defined(_IS_UNIX)
 
     // draw next row
-    for (moremap_s.x = map_b.x; moremap_s.x <= last_x; moremap_s.x++)
-        drawMapCoord (moremap_s);               // does not draw grid
+    drawMapRow (moremap_s.y);                   // does not draw grid
+    moremap_s.x = last_x + 1;                   // same as having scanned the row
 
     // advance row, wrap and reset and finish up at the end
     if ((moremap_s.y += 1) >= map_b.y + EARTH_H) {
@@ -1704,22 +1708,12 @@ void ll2sRaw (const LatLong &ll, SCoord &s, uint8_t edge)
     ll2sScaled (ll, s, edge, tft.SCALESZ);
 }
 
-/* convert a screen coord to lat and long.
- * return whether location is really over valid map.
+/* convert a screen coord to lat and long using only the current projection, ignoring anything
+ * drawn over the map.
+ * return whether location is really on the globe.
  */
-bool s2ll (uint16_t x, uint16_t y, LatLong &ll)
+static bool s2llProj (const SCoord &s, LatLong &ll)
 {
-    SCoord s;
-    s.x = x;
-    s.y = y;
-    return (s2ll (s, ll));
-}
-bool s2ll (const SCoord &s, LatLong &ll)
-{
-    // avoid map
-    if (!overMap(s))
-        return (false);
-
     switch ((MapProjection)map_proj) {
 
     case MAPP_AZIMUTHAL: {
@@ -1793,6 +1787,188 @@ bool s2ll (const SCoord &s, LatLong &ll)
     return (true);
 }
 
+/* convert a screen coord to lat and long.
+ * return whether location is really over valid map.
+ */
+bool s2ll (uint16_t x, uint16_t y, LatLong &ll)
+{
+    SCoord s;
+    s.x = x;
+    s.y = y;
+    return (s2ll (s, ll));
+}
+bool s2ll (const SCoord &s, LatLong &ll)
+{
+    // avoid map
+    if (!overMap(s))
+        return (false);
+
+    return (s2llProj (s, ll));
+}
+
+#if defined(_IS_UNIX)
+
+/* UNIX draws each map pixel at full resolution which requires s2ll at the pixel and at its right and
+ * lower neighbors. The projection only depends on map_proj, getCenterLng(), de_ll and pan_zoom so we save
+ * each result in a table and just look them up again on subsequent sweeps. Rows are filled as first used
+ * so the cost of a change is spread over the next sweep as before.
+ * UNIX only
+ */
+typedef struct {
+    uint8_t proj;                               // map_proj
+    int16_t center_lng;                         // getCenterLng()
+    float de_lat, de_lng;                       // de_ll
+    PanZoom pz;                                 // pan_zoom
+} MapLLKey;
+static MapLLKey map_ll_key;                     // state used to build map_ll_tbl
+static LatLong *map_ll_tbl;                     // EARTH_W x EARTH_H, lat_d is NAN if not on globe
+static bool *map_ll_row_ok;                     // whether each map_ll_tbl row has been filled
+
+/* return whether map_ll_key matches the current projection state, else update it and return false.
+ * UNIX only
+ */
+static bool mapLLKeyOk()
+{
+    int16_t center_lng = getCenterLng();
+    if (map_ll_key.proj == map_proj && map_ll_key.center_lng == center_lng
+                        && map_ll_key.de_lat == de_ll.lat && map_ll_key.de_lng == de_ll.lng
+                        && map_ll_key.pz.zoom == pan_zoom.zoom && map_ll_key.pz.pan_x == pan_zoom.pan_x
+                        && map_ll_key.pz.pan_y == pan_zoom.pan_y)
+        return (true);
+
+    map_ll_key.proj = map_proj;
+    map_ll_key.center_lng = center_lng;
+    map_ll_key.de_lat = de_ll.lat;
+    map_ll_key.de_lng = de_ll.lng;
+    map_ll_key.pz = pan_zoom;
+    return (false);
+}
+
+/* same as s2ll() but using map_ll_tbl.
+ * UNIX only
+ */
+static bool s2llCached (const SCoord &s, LatLong &ll)
+{
+    // table only covers map_b
+    int col = (int)s.x - (int)map_b.x;
+    int row = (int)s.y - (int)map_b.y;
+    if (col < 0 || col >= EARTH_W || row < 0 || row >= EARTH_H)
+        return (false);
+
+    // create table first time then invalidate all rows if anything changed
+    if (!map_ll_tbl) {
+        map_ll_tbl = (LatLong *) malloc (EARTH_W * EARTH_H * sizeof(LatLong));
+        map_ll_row_ok = (bool *) calloc (EARTH_H, sizeof(bool));
+        if (!map_ll_tbl || !map_ll_row_ok)
+            fatalError (_FX("No memory for map table"));
+        (void) mapLLKeyOk();
+    } else if (!mapLLKeyOk()) {
+        memset (map_ll_row_ok, 0, EARTH_H * sizeof(bool));
+    }
+
+    // fill row if first use
+    LatLong *ll_row = &map_ll_tbl[row*EARTH_W];
+    if (!map_ll_row_ok[row]) {
+        SCoord s_row;
+        s_row.y = s.y;
+        for (int i = 0; i < EARTH_W; i++) {
+            s_row.x = map_b.x + i;
+            if (!overActiveMap(s_row) || !s2llProj (s_row, ll_row[i]))
+                ll_row[i].lat_d = NAN;
+        }
+        map_ll_row_ok[row] = true;
+    }
+
+    // return cached location unless not on globe or covered by an overlay
+    const LatLong &ll_c = ll_row[col];
+    if (isnan (ll_c.lat_d) || overMapOverlay(s))
+        return (false);
+    ll = ll_c;
+    return (true);
+}
+
+/* find everything plotEarthSpan() needs to draw the map at s.
+ * return false if s is not over the map.
+ * UNIX only
+ */
+static bool getMapEarthPix (const SCoord &s, Adafruit_RA8875::EarthPix &ep)
+{
+    // find lat/lng at this screen location, bale if not over map
+    LatLong lls;
+    if (!s2llCached(s,lls))
+        return (false);
+
+    /* even though we only draw one application point, s, plotEarth needs points r and d to
+     * interpolate to full map resolution.
+     *   s - - - r
+     *   |
+     *   d
+     */
+    SCoord sr, sd;
+    LatLong llr, lld;
+    sr.x = s.x + 1;
+    sr.y = s.y;
+    if (!s2llCached(sr,llr))
+        llr = lls;
+    sd.x = s.x;
+    sd.y = s.y + 1;
+    if (!s2llCached(sd,lld))
+        lld = lls;
+
+    // find angle between subsolar point and any visible near this location
+    // TODO: actually different at each subpixel, this causes striping
+    float clat = cosf(lls.lat);
+    float slat = sinf(lls.lat);
+    float cos_t = ssslat*slat + csslat*clat*cosf(sun_ss_ll.lng-lls.lng);
+
+    // decide day, night or twilight
+    float fract_day;
+    if (!night_on || cos_t > 0) {
+        // < 90 deg: sunlit
+        fract_day = 1;
+    } else if (cos_t > GRAYLINE_COS) {
+        // blend from day to night
+        fract_day = 1 - powf(cos_t/GRAYLINE_COS, GRAYLINE_POW);
+    } else {
+        // night side
+        fract_day = 0;
+    }
+
+    // the full res map point
+    ep.lat0 = lls.lat_d;
+    ep.lng0 = lls.lng_d;
+    ep.dlatr = llr.lat_d - lls.lat_d;
+    ep.dlngr = llr.lng_d - lls.lng_d;
+    ep.dlatd = lld.lat_d - lls.lat_d;
+    ep.dlngd = lld.lng_d - lls.lng_d;
+    ep.fract_day = fract_day;
+
+    return (true);
+}
+
+/* draw the map row at y, collecting each run of adjacent map pixels for plotEarthSpan().
+ * UNIX only
+ */
+static void drawMapRow (uint16_t y)
+{
+    static Adafruit_RA8875::EarthPix row_ep[EARTH_W];
+    SCoord s;
+    s.y = y;
+    int n = 0;
+    for (s.x = map_b.x; s.x < map_b.x + EARTH_W; s.x++) {
+        if (getMapEarthPix (s, row_ep[n])) {
+            n++;
+        } else if (n > 0) {
+            tft.plotEarthSpan (s.x - n, y, n, row_ep);
+            n = 0;
+        }
+    }
+    if (n > 0)
+        tft.plotEarthSpan (s.x - n, y, n, row_ep);
+}
+
+#endif // _IS_UNIX
+
 /* given numeric difference between two longitudes in degrees, return shortest diff
  */
 float lngDiff (float dlng)
@@ -1973,51 +2149,9 @@ void drawMapCoord (const SCoord &s)
 
 
         // draw one map pixel at full screen resolution. requires lat/lng gradients.
-
-        // find lat/lng at this screen location, bale if not over map
-        LatLong lls;
-        if (!s2ll(s,lls))
-            return; 
-
-        /* even though we only draw one application point, s, plotEarth needs points r and d to
-         * interpolate to full map resolution.
-         *   s - - - r
-         *   |
-         *   d
-         */
-        SCoord sr, sd;
-        LatLong llr, lld;
-        sr.x = s.x + 1;
-        sr.y = s.y;
-        if (!s2ll(sr,llr))
-            llr = lls;
-        sd.x = s.x;
-        sd.y = s.y + 1;
-        if (!s2ll(sd,lld))
-            lld = lls;
-
-        // find angle between subsolar point and any visible near this location
-        // TODO: actually different at each subpixel, this causes striping
-        float clat = cosf(lls.lat);
-        float slat = sinf(lls.lat);
-        float cos_t = ssslat*slat + csslat*clat*cosf(sun_ss_ll.lng-lls.lng);
-
-        // decide day, night or twilight
-        float fract_day;
-        if (!night_on || cos_t > 0) {
-            // < 90 deg: sunlit
-            fract_day = 1;
-        } else if (cos_t > GRAYLINE_COS) {
-            // blend from day to night
-            fract_day = 1 - powf(cos_t/GRAYLINE_COS, GRAYLINE_POW);
-        } else {
-            // night side
-            fract_day = 0;
-        }
-
-        // draw the full res map point
-        tft.plotEarth (s.x, s.y, lls.lat_d, lls.lng_d, llr.lat_d - lls.lat_d, llr.lng_d - lls.lng_d,
-                    lld.lat_d - lls.lat_d, lld.lng_d - lls.lng_d, fract_day);
+        Adafruit_RA8875::EarthPix ep;
+        if (getMapEarthPix (s, ep))
+            tft.plotEarthSpan (s.x, s.y, 1, &ep);
 
     #endif  // _IS_ESP8266
 
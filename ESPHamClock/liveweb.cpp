@@ -3,7 +3,7 @@
  * we listen to liveweb_rw_port and liveweb_ro_port for live.html or web socket upgrades.
  *
  * Browser displays entire HamClock frame buffer. Complete frame is sent initially then only the
- * pixels that change.
+ * pixels that change. Frames are captured and encoded once for all clients, see captureLiveFrame().
  *
  * N.B. this server-side code must work in concert with client-side code in liveweb-html.cpp.
  */
@@ -43,10 +43,64 @@ const int liveweb_maxmax = MAX_CLIENTS-1;               // max max for -help
 static int live_verbose = 0;                            // more chatter if > 0
 
 
+// the screen image is divided into fixed sized blocks and those which have changed are coalesced into regions
+// of height one block but variable length. these are collected and sent as one image of height one
+// block preceded by a header defining the location and size of each region. the coordinates and
+// length of a region are in units of blocks, not pixels, to reduce each value's size to one byte
+// each in the header. smaller regions are more efficient but the coords must fit in 8 bit header value.
+#define BLOK_W          (BUILD_W>1600?16:8)             // pixels wide
+#define BLOK_H          8                               // pixels high
+#define BLOK_NCOLS      (BUILD_W/BLOK_W)                // blocks in each row over entire image
+#define BLOK_NROWS      (BUILD_H/BLOK_H)                // blocks in each col over entire image
+#define BLOK_N          (BLOK_NCOLS*BLOK_NROWS)         // blocks in entire image
+#define BLOK_NPIX       (BLOK_W*BLOK_H)                 // size of 1 block, pixels
+#define BLOK_NBYTES     (BLOK_NPIX*LIVE_BYPPIX)         // size of 1 block, bytes
+#define BLOK_WBYTES     (BLOK_W*LIVE_BYPPIX)            // width of 1 block, bytes
+#define MAX_REGNS       BLOK_N                          // worse case number of regions
+#if BLOK_NCOLS > 255                                    // insure fits into uint8_t
+    #error too many block columns
+#endif
+#if BLOK_NROWS > 255                                    // insure fits into uint8_t
+    #error too many block rows
+#endif
+#if MAX_REGNS > 65535                                   // insure fits into uint16_t
+    #error too many live regions
+#endif
+
+
+// all clients share one series of screen frames, each identified by a generation number. each new frame
+// records which blocks changed from the previous generation in a short history so a client any number of
+// generations behind within the history can be sent just the union of the blocks changed since. each such
+// update is encoded only once then reused by all clients at that same generation. clients that are new or
+// too far behind are sent a full png, which is also encoded only once per generation.
+#define LIVE_NHIST      32                              // n generations of changed-block history
+#define LIVE_NCACHE     8                               // max encodings saved for the current generation
+#define LIVE_MINDT_MS   50                              // min time between captures, ms
+
+typedef struct {
+    int refs;                                           // users of this encoding, free when 0
+    bool ro;                                            // whether image includes the r/o mark
+    uint32_t from_gen;                                  // update is from this gen, 0 for full image
+    uint8_t *hdr;                                       // malloced update header, NULL for full image
+    int hdr_l;                                          // hdr length, bytes
+    uint8_t *png;                                       // malloced png from stbi_write_png_to_mem()
+    int png_l;                                          // png length, bytes
+} LiveEncoding;
+
+static uint32_t live_gen;                               // current generation, 0 until first capture
+static uint8_t *live_img;                               // screen image at live_gen
+static uint8_t *live_scratch;                           // next capture, becomes live_img if changed
+static uint8_t *live_chg[LIVE_NHIST];                   // changed blocks going to gen g in [g%LIVE_NHIST]
+static struct timeval live_tv;                          // time of latest capture
+static LiveEncoding *live_cache[LIVE_NCACHE];           // encodings to reach live_gen
+static int live_ncache;                                 // n in use in live_cache[]
+static pthread_mutex_t live_lock = PTHREAD_MUTEX_INITIALIZER;   // guards all live_ variables
+
+
 // complete scene on browser for each web socket
 typedef struct {
     ws_cli_conn_t *client;                              // opaque pointer unique to each connection, else NULL
-    uint8_t *pixels;                                    // this client's current display image
+    uint32_t gen;                                       // generation showing in this client, 0 if none
 } SessionInfo;
 static SessionInfo *si_list;                            // malloced list
 static int si_n;                                        // n malloced
@@ -75,163 +129,237 @@ static void bye (const char *fmt, ...)
 }
 
 
-/* stbi_write_png_to_func helper to write the given array to the given ws_cli_conn_t in context.
+/* send the given png image to the given client.
  */
-static void wifiSTBWrite_helper (void *context, void *data, int size)
+static void sendLivePNG (ws_cli_conn_t *client, const uint8_t *png, int png_l)
 {
-    ws_cli_conn_t *client = (ws_cli_conn_t *)context;
-    int n_sent = ws_sendframe_bin (client, (const char *) data, size);
-    if (n_sent != size)
-        Serial.printf ("LIVE: client %s: wrong png write len: %d != %d\n", ws_getaddress(client), n_sent, size);
+    int n_sent = ws_sendframe_bin (client, (const char *) png, png_l);
+    if (n_sent != png_l)
+        Serial.printf ("LIVE: client %s: wrong png write len: %d != %d\n", ws_getaddress(client), n_sent, png_l);
     if (live_verbose > 1) {
-        Serial.printf ("LIVE: sent image %d bytes\n", size);
+        Serial.printf ("LIVE: sent image %d bytes\n", png_l);
         if (live_verbose > 2) {
             FILE *fp = fopen ("/tmp/live.png", "w");
-            fwrite (data, size, 1, fp);
+            fwrite (png, png_l, 1, fp);
             fclose(fp);
         }
     }
 }
 
-/* return the pixels pointer for the existing client, else NULL.
- * pixels pointer is safe to use outside si_lock and even if si_list is later realloced (and hence moves).
+/* return the generation now being displayed by the given client, 0 if none or client is unknown.
  */
-static uint8_t *getSIPixels (ws_cli_conn_t *client)
+static uint32_t getSIGen (ws_cli_conn_t *client)
 {
-    // protect list while manipulating -- N.B. unlock before returning!
-    pthread_mutex_lock (&si_lock);
+    uint32_t gen = 0;
 
-    // scan si_list for client
-    SessionInfo *found_sip = NULL;
+    pthread_mutex_lock (&si_lock);
+    bool found = false;
     for (int i = 0; i < si_n; i++) {
         if (si_list[i].client == client) {
-            found_sip = &si_list[i];
+            gen = si_list[i].gen;
+            found = true;
             break;
         }
     }
+    pthread_mutex_unlock (&si_lock);
 
-    // capture pixels address before unlocking
-    uint8_t *pixels = NULL;
-    if (found_sip)
-        pixels = found_sip->pixels;
-    else
-        Serial.printf ("LIVE: client %s: missing pixels\n", ws_getaddress(client));
+    if (!found)
+        Serial.printf ("LIVE: client %s: missing session\n", ws_getaddress(client));
+
+    return (gen);
+}
 
-    // unlock
+/* record the generation now being displayed by the given client.
+ */
+static void setSIGen (ws_cli_conn_t *client, uint32_t gen)
+{
+    pthread_mutex_lock (&si_lock);
+    for (int i = 0; i < si_n; i++) {
+        if (si_list[i].client == client) {
+            si_list[i].gen = gen;
+            break;
+        }
+    }
     pthread_mutex_unlock (&si_lock);
+}
 
-    // return result
-    return (pixels);
+/* release one use of the given encoding, freeing if no longer used.
+ * N.B. caller must hold live_lock
+ */
+static void releaseLiveEncoding (LiveEncoding *lep)
+{
+    if (--lep->refs == 0) {
+        free (lep->hdr);
+        free (lep->png);
+        free (lep);
+    }
 }
 
+/* discard all cached encodings, such as when a new generation is captured.
+ * N.B. caller must hold live_lock
+ */
+static void flushLiveCache (void)
+{
+    for (int i = 0; i < live_ncache; i++)
+        releaseLiveEncoding (live_cache[i]);
+    live_ncache = 0;
+}
 
-/* send difference between client's last known screen image and the current image,
- * then store current image back in client's SessionInfo.
+/* capture a new frame if it has been long enough and anything changed since live_gen.
+ * N.B. caller must hold live_lock
  */
-static void updateExistingClient (ws_cli_conn_t *client)
+static void captureLiveFrame (void)
 {
-    // curious how long these steps take
+    // first call gets memory for the images and change history
+    if (!live_img) {
+        live_img = (uint8_t *) malloc (LIVE_NBYTES);
+        live_scratch = (uint8_t *) malloc (LIVE_NBYTES);
+        if (!live_img || !live_scratch)
+            bye ("No memory for live images\n");
+        for (int i = 0; i < LIVE_NHIST; i++) {
+            live_chg[i] = (uint8_t *) malloc (BLOK_N);
+            if (!live_chg[i])
+                bye ("No memory for live history\n");
+        }
+        stbi_write_png_compression_level = 2;   // faster with hardly any increase in size
+    }
+
+    // not too often, all clients polling within this period share the same frame
     struct timeval tv0;
     gettimeofday (&tv0, NULL);
-
-    // find client's current pixels
-    uint8_t *pixels = getSIPixels(client);
-    if (!pixels)
+    if (live_gen != 0 && TVDELUS (live_tv, tv0) < LIVE_MINDT_MS*1000)
         return;
+    live_tv = tv0;
 
-    // make a copy of client's last known image
-    uint8_t *img_client = (uint8_t *) malloc (LIVE_NBYTES);
-    if (!img_client)
-        bye ("No memory for LIVE update\n");
-    memcpy (img_client, pixels, LIVE_NBYTES);
-
-    // replace clients's pixels with current screen contents
-    if (!tft.getRawPix (pixels, LIVE_NPIX))
+    // capture
+    if (!tft.getRawPix (live_scratch, LIVE_NPIX))
         bye ("getRawPix for update failed\n");
-    uint8_t *img_now = pixels;                      // better name
+
+    // find each block that changed
+    uint8_t *chg = live_chg[(live_gen+1) % LIVE_NHIST];
+    int n_chg = 0;
+    for (int ry = 0; ry < BLOK_NROWS; ry++) {
+
+        // pre-check an image band all the way across BLOK_H hi, skip entirely if no change anywhere
+        uint8_t *chg_row = &chg[ry*BLOK_NCOLS];
+        int band_start = ry*LIVE_BYPPIX*BLOK_H*BUILD_W;
+        if (live_gen != 0 && memcmp (&live_scratch[band_start], &live_img[band_start],
+                                                LIVE_BYPPIX*BLOK_H*BUILD_W) == 0) {
+            memset (chg_row, 0, BLOK_NCOLS);
+            continue;
+        }
+
+        // something changed, scan across this band checking each block
+        for (int rx = 0; rx < BLOK_NCOLS; rx++) {
+            int blok_start = band_start + rx*BLOK_WBYTES;
+            uint8_t *now0 = &live_scratch[blok_start];  // first pixel in this block of new image
+            uint8_t *pre0 = &live_img[blok_start];      // first pixel in this block of live_gen image
+
+            // check each row of this block for any change
+            bool blok_changed = live_gen == 0;
+            for (int rr = 0; !blok_changed && rr < BLOK_H; rr++)
+                if (memcmp (now0+rr*LIVE_BYPPIX*BUILD_W, pre0+rr*LIVE_BYPPIX*BUILD_W, BLOK_WBYTES) != 0)
+                    blok_changed = true;
+            chg_row[rx] = blok_changed;
+            if (blok_changed)
+                n_chg++;
+        }
+    }
+
+    // new generation only if something changed
+    if (n_chg > 0) {
+        uint8_t *tmp = live_img;
+        live_img = live_scratch;
+        live_scratch = tmp;
+        if (++live_gen == 0)                    // 0 is reserved to mean no image
+            live_gen = 1;
+        flushLiveCache();
+    }
 
     if (live_verbose > 1) {
         struct timeval tv1;
         gettimeofday (&tv1, NULL);
-        Serial.printf ("LIVE: client %s: copying img and reading new pixels took %ld usec\n",
-                                ws_getaddress(client), TVDELUS (tv0,tv1));
+        Serial.printf ("LIVE: capture gen %u found %d changed blocks in %ld usec\n", live_gen, n_chg,
+                                TVDELUS (tv0,tv1));
     }
+}
 
-    // add a small indicator to mark the r/o page.
-    if (client->port == liveweb_ro_port) {
-        // N.B. do not use drawPixelRaw() because that will draw in real fb and thus seen by everyone
-        // define location of r/o mark in raw pixels, then mult by LIVE_BYPPIX to get array index
-        #define RO_MARK_RAWX (tft.SCALESZ*lkscrn_b.x)
-        #define RO_MARK_RAWY (tft.SCALESZ*(lkscrn_b.y+lkscrn_b.h+3))
-        #define RO_MARK_RAWW (tft.SCALESZ*lkscrn_b.w)
-        #define RO_MARK_RAWH (tft.SCALESZ*3)
-        const uint8_t rgb_mark[LIVE_BYPPIX] = {255,0,0};
-        for (int y = RO_MARK_RAWY; y < RO_MARK_RAWY+RO_MARK_RAWH; y++)
-            for (int x = RO_MARK_RAWX; x < RO_MARK_RAWX+RO_MARK_RAWW; x++)
-                memcpy (&img_now[y*LIVE_BYPPIX*BUILD_W + x*LIVE_BYPPIX], rgb_mark, LIVE_BYPPIX);
-    }
-
-    // we only send small regions that have changed since previous, ie changes from img_client to img_now.
-    // image is divided into fixed sized blocks and those which have changed are coalesced into regions
-    // of height one block but variable length. these are collected and sent as one image of height one
-    // block preceded by a header defining the location and size of each region. the coordinates and
-    // length of a region are in units of blocks, not pixels, to reduce each value's size to one byte
-    // each in the header. smaller regions are more efficient but the coords must fit in 8 bit header value.
-    #define BLOK_W      (BUILD_W>1600?16:8)             // pixels wide
-    #define BLOK_H      8                               // pixels high
-    #define BLOK_NCOLS  (BUILD_W/BLOK_W)                // blocks in each row over entire image
-    #define BLOK_NROWS  (BUILD_H/BLOK_H)                // blocks in each col over entire image
-    #define BLOK_NPIX   (BLOK_W*BLOK_H)                 // size of 1 block, pixels
-    #define BLOK_NBYTES (BLOK_NPIX*LIVE_BYPPIX)         // size of 1 block, bytes
-    #define BLOK_WBYTES (BLOK_W*LIVE_BYPPIX)            // width of 1 block, bytes
-    #define MAX_REGNS   (BLOK_NCOLS*BLOK_NROWS)         // worse case number of regions
-    #if BLOK_NCOLS > 255                                // insure fits into uint8_t
-        #error too many block columns
-    #endif
-    #if BLOK_NROWS > 255                                // insure fits into uint8_t
-        #error too many block rows
-    #endif
-    #if MAX_REGNS > 65535                               // insure fits into uint16_t
-        #error too many live regions
-    #endif
+/* add a small indicator to mark the r/o page to the given image which is located at [x0,y0] and
+ * is w pixels wide and h high. rows are img_w pixels apart.
+ */
+static void drawROMark (uint8_t *img, int x0, int y0, int w, int h, int img_w)
+{
+    // N.B. do not use drawPixelRaw() because that will draw in real fb and thus seen by everyone
+    // define location of r/o mark in raw pixels
+    #define RO_MARK_RAWX (tft.SCALESZ*lkscrn_b.x)
+    #define RO_MARK_RAWY (tft.SCALESZ*(lkscrn_b.y+lkscrn_b.h+3))
+    #define RO_MARK_RAWW (tft.SCALESZ*lkscrn_b.w)
+    #define RO_MARK_RAWH (tft.SCALESZ*3)
+    const uint8_t rgb_mark[LIVE_BYPPIX] = {255,0,0};
+
+    // intersection of image with mark
+    int mx0 = RO_MARK_RAWX > x0 ? RO_MARK_RAWX : x0;
+    int mx1 = RO_MARK_RAWX+RO_MARK_RAWW < x0+w ? RO_MARK_RAWX+RO_MARK_RAWW : x0+w;
+    int my0 = RO_MARK_RAWY > y0 ? RO_MARK_RAWY : y0;
+    int my1 = RO_MARK_RAWY+RO_MARK_RAWH < y0+h ? RO_MARK_RAWY+RO_MARK_RAWH : y0+h;
+
+    for (int y = my0; y < my1; y++)
+        for (int x = mx0; x < mx1; x++)
+            memcpy (&img[((y-y0)*img_w + (x-x0))*LIVE_BYPPIX], rgb_mark, LIVE_BYPPIX);
+}
+
+/* encode the current live_img as one full png.
+ * N.B. caller must hold live_lock
+ */
+static void encodeLiveFull (LiveEncoding *lep)
+{
+    if (lep->ro) {
+        // mark a copy
+        uint8_t *img = (uint8_t *) malloc (LIVE_NBYTES);
+        if (!img)
+            bye ("No memory for r/o image\n");
+        memcpy (img, live_img, LIVE_NBYTES);
+        drawROMark (img, 0, 0, BUILD_W, BUILD_H, BUILD_W);
+        lep->png = stbi_write_png_to_mem (img, LIVE_RBYTES, BUILD_W, BUILD_H, COMP_RGB, &lep->png_l);
+        free (img);
+    } else {
+        lep->png = stbi_write_png_to_mem (live_img, LIVE_RBYTES, BUILD_W, BUILD_H, COMP_RGB, &lep->png_l);
+    }
+}
 
+/* encode the blocks of live_img that changed since lep->from_gen as a header and one png of all regions.
+ * N.B. caller must hold live_lock
+ */
+static void encodeLiveUpdate (LiveEncoding *lep)
+{
     // time block creation
+    struct timeval tv0;
     gettimeofday (&tv0, NULL);
 
+    // union of all blocks changed after from_gen through live_gen
+    StackMalloc chg_mem(BLOK_N);
+    uint8_t *chg = (uint8_t *) chg_mem.getMem();
+    memset (chg, 0, BLOK_N);
+    for (uint32_t g = lep->from_gen + 1; g != live_gen + 1; g++) {
+        const uint8_t *chg_g = live_chg[g % LIVE_NHIST];
+        for (int i = 0; i < BLOK_N; i++)
+            chg[i] |= chg_g[i];
+    }
+
     // set header to location and length of each changed region.
     typedef struct {
         uint8_t x, y, l;                                // region location and length in units of blocks
     } RegnLoc;
-    RegnLoc locs[MAX_REGNS];                            // room for max number of header region entries
+    StackMalloc locs_mem(MAX_REGNS*sizeof(RegnLoc));
+    RegnLoc *locs = (RegnLoc *) locs_mem.getMem();      // room for max number of header region entries
     uint16_t n_regns = 0;                               // n regions defined so far
     int n_bloks = 0;                                    // n blocks within all regions so far
 
-    // build locs by checking each region for change across then down
+    // build locs by checking each block for change across then down
     for (int ry = 0; ry < BLOK_NROWS; ry++) {
-
-        // pre-check an image band all the way across BLOK_COLS hi, skip entirely if no change anywhere
-        int band_start = ry*LIVE_BYPPIX*BLOK_H*BUILD_W;
-        if (memcmp (&img_now[band_start], &img_client[band_start], LIVE_BYPPIX*BLOK_H*BUILD_W) == 0)
-            continue;
-
-        // something changed, scan across this band checking each block
         locs[n_regns].l = 0;                            // init n contiguous blocks that start here
         for (int rx = 0; rx < BLOK_NCOLS; rx++) {
-            int blok_start = band_start + rx*BLOK_WBYTES;
-            uint8_t *now0 = &img_now[blok_start];       // first pixel in this block of current image
-            uint8_t *pre0 = &img_client[blok_start];    // first pixel in this block of image in client
-
-            // check each row of this block for any change, start or add to region 
-            bool blok_changed = false;                  // set if any changed pixels in this block
-            for (int rr = 0; rr < BLOK_H; rr++) {
-                if (memcmp (now0+rr*LIVE_BYPPIX*BUILD_W, pre0+rr*LIVE_BYPPIX*BUILD_W, BLOK_WBYTES) != 0) {
-                    blok_changed = true;
-                    break;
-                }
-            }
-
-            // add to or start new region
-            if (blok_changed) {
+            if (chg[ry*BLOK_NCOLS + rx]) {
                 if (locs[n_regns].l == 0) {
                     locs[n_regns].x = rx;
                     locs[n_regns].y = ry;
@@ -261,8 +389,10 @@ static void updateExistingClient (ws_cli_conn_t *client)
     for (int ry = 0; ry < BLOK_H; ry++) {
         for (int i = 0; i < n_regns; i++) {
             RegnLoc *rp = &locs[i];
-            uint8_t *now0 = &img_now[BUILD_W*LIVE_BYPPIX*(ry+BLOK_H*rp->y) + BLOK_WBYTES*rp->x];
+            uint8_t *now0 = &live_img[BUILD_W*LIVE_BYPPIX*(ry+BLOK_H*rp->y) + BLOK_WBYTES*rp->x];
             memcpy (chg0, now0, BLOK_WBYTES*rp->l);
+            if (lep->ro)
+                drawROMark (chg0, BLOK_W*rp->x, ry+BLOK_H*rp->y, BLOK_W*rp->l, 1, BLOK_W*rp->l);
             chg0 += BLOK_WBYTES*rp->l;
         }
     }
@@ -272,17 +402,19 @@ static void updateExistingClient (ws_cli_conn_t *client)
     if (live_verbose > 1) {
         struct timeval tv1;
         gettimeofday (&tv1, NULL);
-        Serial.printf ("LIVE: client %s: built %d regions from %d blocks in %ld usec\n",
-                        ws_getaddress(client), n_regns, n_bloks, TVDELUS (tv0, tv1));
+        Serial.printf ("LIVE: gen %u..%u: built %d regions from %d blocks in %ld usec\n",
+                        lep->from_gen, live_gen, n_regns, n_bloks, TVDELUS (tv0, tv1));
     }
 
     // time header creation and png write
     gettimeofday (&tv0, NULL);
 
     // build 4-byte header followed by x,y,l of each of n regions in units of blocks.
-    unsigned hdr_l = 4+3*n_regns;
-    StackMalloc hdr_mem(hdr_l);
-    uint8_t *hdr = (uint8_t *) hdr_mem.getMem();
+    lep->hdr_l = 4+3*n_regns;
+    lep->hdr = (uint8_t *) malloc (lep->hdr_l);
+    if (!lep->hdr)
+        bye ("No memory for live header\n");
+    uint8_t *hdr = lep->hdr;
     hdr[0] = BLOK_W;                            // block width, pixels
     hdr[1] = BLOK_H;                            // block height, pixels
     hdr[2] = n_regns >> 8;                      // n regions, MSB
@@ -295,50 +427,110 @@ static void updateExistingClient (ws_cli_conn_t *client)
             Serial.printf ("   %d,%d %dx%d\n", locs[i].x*BLOK_W, locs[i].y*BLOK_H, locs[i].l*BLOK_W, BLOK_H);
     }
 
-    // always send header
-    unsigned n_hdrsent = ws_sendframe_bin (client, (const char *) hdr, hdr_l);
-    if (n_hdrsent != hdr_l)
-        Serial.printf ("LIVE: client %s: wrong header write %u != %d\n", ws_getaddress(client), n_hdrsent, hdr_l);
-
     // followed by one image containing one column BLOK_W wide of all changed regions
-    stbi_write_png_to_func (wifiSTBWrite_helper, client, BLOK_W*n_bloks, BLOK_H,
-                            COMP_RGB, chg_regns, BLOK_WBYTES*n_bloks);
+    lep->png = stbi_write_png_to_mem (chg_regns, BLOK_WBYTES*n_bloks, BLOK_W*n_bloks, BLOK_H, COMP_RGB,
+                            &lep->png_l);
 
     if (live_verbose > 1) {
         struct timeval tv1;
         gettimeofday (&tv1, NULL);
-        Serial.printf ("LIVE: client %s: write hdr %d bytes and update took %ld usec\n",
-                        ws_getaddress(client), hdr_l, TVDELUS (tv0,tv1));
+        Serial.printf ("LIVE: gen %u..%u: encoded hdr %d and png %d bytes in %ld usec\n",
+                        lep->from_gen, live_gen, lep->hdr_l, lep->png_l, TVDELUS (tv0,tv1));
     }
 
-    if (live_verbose > 1)
-        Serial.printf ("LIVE: client %s: sent update with %d regions %d blocks\n",
-                        ws_getaddress(client), n_regns, n_bloks);
-
-    // finished with temps
+    // finished with temp
     free (chg_regns);
-    free (img_client);
 }
 
-/* capture fresh screen image for client and send.
+/* return an encoding that brings a client showing from_gen up to live_gen, from_gen 0 for full image.
+ * reuse a cached encoding if possible else create a new one and add to cache.
+ * caller must call releaseLiveEncoding() when finished.
+ * N.B. caller must hold live_lock
  */
-static void sendClientPNG (ws_cli_conn_t *client)
+static LiveEncoding *getLiveEncoding (bool ro, uint32_t from_gen)
 {
-    // get this client's current pixels array
-    uint8_t *pixels = getSIPixels(client);
-    if (!pixels)
-        return;
+    // check cache
+    for (int i = 0; i < live_ncache; i++) {
+        LiveEncoding *lep = live_cache[i];
+        if (lep->ro == ro && lep->from_gen == from_gen) {
+            lep->refs++;
+            return (lep);
+        }
+    }
 
-    // fresh capture
-    if (!tft.getRawPix (pixels, LIVE_NPIX))
-        bye ("getRawPix for png failed\n");
+    // create new
+    LiveEncoding *lep = (LiveEncoding *) calloc (1, sizeof(LiveEncoding));
+    if (!lep)
+        bye ("No memory for live encoding\n");
+    lep->ro = ro;
+    lep->from_gen = from_gen;
+    if (from_gen == 0)
+        encodeLiveFull (lep);
+    else
+        encodeLiveUpdate (lep);
+    if (!lep->png)
+        bye ("live png encoding failed\n");
+
+    // one ref for the caller, another if also saved in the cache
+    lep->refs = 1;
+    if (live_ncache < LIVE_NCACHE) {
+        lep->refs++;
+        live_cache[live_ncache++] = lep;
+    }
 
-    // convert image to and send as png
-    stbi_write_png_compression_level = 2;       // faster with hardly any increase in size
-    stbi_write_png_to_func (wifiSTBWrite_helper, client, BUILD_W, BUILD_H, COMP_RGB, pixels, LIVE_RBYTES);
+    return (lep);
+}
 
-    if (live_verbose)
-        Serial.printf ("LIVE: client %s: sent full PNG\n", ws_getaddress(client));
+/* bring the given client up to date with the current screen image.
+ * send full png if want_full, client has none or is too far behind, else send update since client's gen.
+ */
+static void updateLiveClient (ws_cli_conn_t *client, bool want_full)
+{
+    // curious how long these steps take
+    struct timeval tv0;
+    gettimeofday (&tv0, NULL);
+
+    bool ro = client->port == liveweb_ro_port;
+    uint32_t client_gen = getSIGen (client);
+
+    // capture and encode once for everyone
+    pthread_mutex_lock (&live_lock);
+        captureLiveFrame();
+        uint32_t from_gen = client_gen;
+        if (want_full || client_gen == 0 || live_gen - client_gen >= LIVE_NHIST)
+            from_gen = 0;
+        uint32_t to_gen = live_gen;
+        LiveEncoding *lep = getLiveEncoding (ro, from_gen);
+    pthread_mutex_unlock (&live_lock);
+
+    if (live_verbose > 1) {
+        struct timeval tv1;
+        gettimeofday (&tv1, NULL);
+        Serial.printf ("LIVE: client %s: gen %u..%u ready in %ld usec\n", ws_getaddress(client),
+                            from_gen, to_gen, TVDELUS (tv0,tv1));
+    }
+
+    // send without holding live_lock, update is header followed by png
+    if (lep->hdr) {
+        unsigned n_hdrsent = ws_sendframe_bin (client, (const char *) lep->hdr, lep->hdr_l);
+        if (n_hdrsent != (unsigned)lep->hdr_l)
+            Serial.printf ("LIVE: client %s: wrong header write %u != %d\n", ws_getaddress(client),
+                                n_hdrsent, lep->hdr_l);
+    }
+    sendLivePNG (client, lep->png, lep->png_l);
+    setSIGen (client, to_gen);
+
+    if (live_verbose) {
+        if (from_gen == 0)
+            Serial.printf ("LIVE: client %s: sent full PNG\n", ws_getaddress(client));
+        else if (live_verbose > 1)
+            Serial.printf ("LIVE: client %s: sent update gen %u..%u\n", ws_getaddress(client),
+                                from_gen, to_gen);
+    }
+
+    pthread_mutex_lock (&live_lock);
+        releaseLiveEncoding (lep);
+    pthread_mutex_unlock (&live_lock);
 }
 
 /* send message that user wants full screen.
@@ -367,7 +559,7 @@ static void getLivePNG (ws_cli_conn_t *client, char args[], size_t args_len)
     (void)args;
     (void)args_len;
 
-    sendClientPNG (client);
+    updateLiveClient (client, true);
 }
 
 /* client running liveweb-html.cpp is asking for incremental screen update.
@@ -391,7 +583,7 @@ static void getLiveUpdate (ws_cli_conn_t *client, char args[], size_t args_len)
         liveweb_openurl = NULL;
     }
 
-    updateExistingClient (client);
+    updateLiveClient (client, false);
 }
 
 /* client running liveweb-html.cpp sending us a character to act on as if typed locally.
@@ -608,11 +800,6 @@ static void ws_onopen(ws_cli_conn_t *client)
         SessionInfo *sip = &si_list[i];
         if (!sip->client) {
             new_sip = sip;
-            // insure no stale pixels
-            if (new_sip->pixels) {
-                free (new_sip->pixels);
-                new_sip->pixels = NULL;
-            }
             break;
         }
     }
@@ -632,12 +819,10 @@ static void ws_onopen(ws_cli_conn_t *client)
         }
     }
 
-    // init including memory for pixels but don't capture until client asks for them
+    // init with no image until client asks for one
     if (new_sip) {
         new_sip->client = client;
-        new_sip->pixels = (uint8_t *) malloc (LIVE_NBYTES);
-        if (!new_sip->pixels)
-            bye ("No memory for new live session pixels\n");
+        new_sip->gen = 0;
     }
 
     // ok
@@ -651,21 +836,18 @@ static void ws_onclose (ws_cli_conn_t *client)
     Serial.printf ("LIVE: client %s: disconnected\n", ws_getaddress(client));
 
     // remove from si_list
+    pthread_mutex_lock (&si_lock);
     for (int i = 0; i < si_n; i++) {
         SessionInfo *sip = &si_list[i];
         if (sip->client == client) {
             sip->client = NULL;
-            // recycle pixel memory
-            if (sip->pixels) {
-                free (sip->pixels);
-                sip->pixels = NULL;
-            }
-            return;
+            sip->gen = 0;
+            break;
         }
     }
+    pthread_mutex_unlock (&si_lock);
 
-    // if get here, client was not found in si_list -- usually just because we closed because too many 
-    // Serial.printf ("LIVE: client %s: disappeared after closing websocket\n", ws_getaddress(client));
+    // N.B. client may not be found in si_list -- usually just because we closed because too many 
 }
 
 /* callback when browser sends us a message on a websocket
@@ -1,6 +1,6 @@
 /* this file manages the background maps, both static styles and VOACAP area propagation.
  *
- * all map files are RGB565 BMP V4 format.
+ * all map files are RGB565 BMP V4 format, or that compressed into HCZ format by mapzip.cpp.
  */
 
 
@@ -124,8 +124,69 @@ static bool bmpHdrOk (char *buf, uint32_t w, uint32_t h, uint32_t *filesizep)
         return (true);
 }
 
+/* return whether the given map file name is for a compressed HCZ file, see mapzip.cpp.
+ */
+static bool isZMapName (const char *file)
+{
+        size_t fl = strlen (file);
+        return (fl > 4 && strcmp (file + fl - 4, ".hcz") == 0);
+}
+
+/* given a BMP map file name fill zfile with the name of its compressed HCZ form.
+ * N.B. we do not check for suffient room in zfile
+ */
+static void buildZMapName (const char *file, char *zfile)
+{
+        size_t fl = strlen (file);
+        snprintf (zfile, LFS_NAME_MAX, "%.*s.hcz", (int)(fl > 4 ? fl - 4 : fl), file);
+}
+
+/* return whether the given HCZ_HDRSZ+BHDRSZ bytes are a proper header for a compressed map of size w x h.
+ * if so also return the number of bands and rows per band.
+ */
+static bool zmapHdrOk (char *buf, uint32_t w, uint32_t h, uint32_t *n_bandsp, uint32_t *band_rowsp)
+{
+        if (memcmp (buf, HCZ_MAGIC, 4) != 0) {
+            Serial.printf (_FX("HCZ hdr err: %.4s\n"), buf);
+            return (false);
+        }
+
+        uint32_t ncols = unpackLE4(buf+4);
+        uint32_t nrows = unpackLE4(buf+8);
+        uint32_t band_rows = unpackLE4(buf+12);
+        uint32_t n_bands = unpackLE4(buf+16);
+        if (ncols != w || nrows != h || band_rows == 0 || n_bands != (h + band_rows - 1)/band_rows) {
+            Serial.printf (_FX("HCZ hdr err: %u %u %u %u\n"), ncols, nrows, band_rows, n_bands);
+            return (false);
+        }
+
+        uint32_t filesize;
+        if (!bmpHdrOk (buf + HCZ_HDRSZ, w, h, &filesize))
+            return (false);
+
+        *n_bandsp = n_bands;
+        *band_rowsp = band_rows;
+        return (true);
+}
+
+/* return the total number of compressed bytes in the given band size table, or 0 if any is
+ * impossibly large for a band of w x band_rows.
+ */
+static uint32_t zmapBandsSize (char *table, uint32_t n_bands, uint32_t w, uint32_t band_rows)
+{
+        uint32_t total = 0;
+        for (uint32_t i = 0; i < n_bands; i++) {
+            uint32_t csize = unpackLE4 (table + 4*i);
+            if (csize == 0 || csize > w*band_rows*BPERBMPPIX)
+                return (0);
+            total += csize;
+        }
+        return (total);
+}
+
 /* download the given file of expected size and load into LittleFS.
- * client is already postioned at first byte of image.
+ * file may be either BMP or compressed HCZ according to its name.
+ * client is already postioned at first byte of file.
  */
 static bool downloadMapFile (WiFiClient &client, const char *file, const char *title)
 {
@@ -135,11 +196,15 @@ static bool downloadMapFile (WiFiClient &client, const char *file, const char *t
         bool ok = false;
 
         // alloc copy buffer
-        #define COPY_BUF_SIZE 1024                      // > BHDRSZ but beware RAM pressure
-        const uint32_t npixbytes = ZOOM_W*ZOOM_H*BPERBMPPIX;
+        #define COPY_BUF_SIZE 65536                     // > HCZ_HDRSZ + BHDRSZ + HCZ band table
+        uint32_t npixbytes = ZOOM_W*ZOOM_H*BPERBMPPIX;  // or n compressed bytes if zipped
         uint32_t nbufbytes = 0;
         StackMalloc buf_mem(COPY_BUF_SIZE);
         char *copy_buf = (char *) buf_mem.getMem();
+        const bool zipped = isZMapName (file);
+        const uint32_t nhdrbytes = zipped ? HCZ_HDRSZ + BHDRSZ : BHDRSZ;
+        char *bmp_hdr = zipped ? copy_buf + HCZ_HDRSZ : copy_buf;
+        uint32_t n_bands = 0, band_rows = 0;
 
         // (re)create file
         // extra open/close/remove avoids LitteLFS duplicate COW behavior
@@ -155,16 +220,19 @@ static bool downloadMapFile (WiFiClient &client, const char *file, const char *t
         }
 
         // read and check remote header
-        for (int i = 0; i < BHDRSZ; i++) {
-            if (!getTCPChar (client, &copy_buf[i])) {
-                Serial.printf (_FX("short header: %.*s\n"), i, copy_buf); // might be err message
-                mapMsg (true, 1000, _FX("%s: header is short"), title);
-                goto out;
-            }
+        nbufbytes = getTCPBytes (client, copy_buf, nhdrbytes);
+        if (nbufbytes != nhdrbytes) {
+            Serial.printf (_FX("short header: %.*s\n"), (int)nbufbytes, copy_buf); // might be err message
+            mapMsg (true, 1000, _FX("%s: header is short"), title);
+            goto out;
+        }
+        if (zipped && !zmapHdrOk (copy_buf, ZOOM_W, ZOOM_H, &n_bands, &band_rows)) {
+            mapMsg (true, 1000, _FX("%s: bad header"), title);
+            goto out;
         }
         uint32_t filesize;
-        if (!bmpHdrOk (copy_buf, ZOOM_W, ZOOM_H, &filesize)) {
-            Serial.printf (_FX("bad header: %.*s\n"), BHDRSZ, copy_buf); // might be err message
+        if (!bmpHdrOk (bmp_hdr, ZOOM_W, ZOOM_H, &filesize)) {
+            Serial.printf (_FX("bad header: %.*s\n"), BHDRSZ, bmp_hdr); // might be err message
             mapMsg (true, 1000, _FX("%s: bad header"), title);
             goto out;
         }
@@ -174,8 +242,24 @@ static bool downloadMapFile (WiFiClient &client, const char *file, const char *t
             goto out;
         }
 
+        // compressed files also have a table of band sizes which then sum to the remaining length
+        if (zipped) {
+            uint32_t ntblbytes = 4*n_bands;
+            if (nhdrbytes + ntblbytes > COPY_BUF_SIZE
+                        || getTCPBytes (client, copy_buf+nhdrbytes, ntblbytes) != (int)ntblbytes) {
+                mapMsg (true, 1000, _FX("%s: header is short"), title);
+                goto out;
+            }
+            npixbytes = zmapBandsSize (copy_buf+nhdrbytes, n_bands, ZOOM_W, band_rows);
+            if (npixbytes == 0) {
+                mapMsg (true, 1000, _FX("%s: bad header"), title);
+                goto out;
+            }
+            nbufbytes = nhdrbytes + ntblbytes;
+        }
+
         // write header
-        f.write (copy_buf, BHDRSZ);
+        f.write (copy_buf, nbufbytes);
         updateClocks(false);
 
         // copy pixels
@@ -184,35 +268,42 @@ static bool downloadMapFile (WiFiClient &client, const char *file, const char *t
             bool want_msg = ZOOM_W >= 2640;              // only for the largish files
             mapMsg (want_msg, 100, _FX("%s: downloading"), title);
             uint32_t t0 = millis();
-            for (uint32_t nbytescopy = 0; nbytescopy < npixbytes; nbytescopy++) {
+            int prev_pct = -1;
+            for (uint32_t nbytescopy = 0; nbytescopy < npixbytes; nbytescopy += nbufbytes) {
 
-                if (((nbytescopy%(npixbytes/10)) == 0) || nbytescopy == npixbytes-1) {
+                int pct = 100*nbytescopy/npixbytes;
+                if (pct/10 != prev_pct/10) {
                     if (pan_zoom.zoom > MIN_ZOOM)
-                        mapMsg (want_msg, 0, _FX("%s %dx: %3d%%"), title, pan_zoom.zoom,
-                                                                100*(nbytescopy+1)/npixbytes);
+                        mapMsg (want_msg, 0, _FX("%s %dx: %3d%%"), title, pan_zoom.zoom, pct);
                     else
-                        mapMsg (want_msg, 0, _FX("%s: %3d%%"), title, 100*(nbytescopy+1)/npixbytes);
+                        mapMsg (want_msg, 0, _FX("%s: %3d%%"), title, pct);
+                    prev_pct = pct;
                 }
 
-                // read more
-                if (nbufbytes < COPY_BUF_SIZE && !getTCPChar (client, &copy_buf[nbufbytes++])) {
-                    Serial.printf (_FX("%s: file is short: %u %u\n"), title, nbytescopy, npixbytes);
+                // read next buffer full, or the remainder
+                nbufbytes = npixbytes - nbytescopy;
+                if (nbufbytes > COPY_BUF_SIZE)
+                    nbufbytes = COPY_BUF_SIZE;
+                uint32_t n_read = getTCPBytes (client, copy_buf, nbufbytes);
+                if (n_read != nbufbytes) {
+                    Serial.printf (_FX("%s: file is short: %u %u\n"), title, nbytescopy+n_read, npixbytes);
                     mapMsg (true, 1000, _FX("%s: file is short"), title);
                     goto out;
                 }
 
-                // write when copy_buf is full or last
-                if (nbufbytes == COPY_BUF_SIZE || nbytescopy == npixbytes-1) {
-                    resetWatchdog();
-                    updateClocks(false);
-                    if (f.write (copy_buf, nbufbytes) != nbufbytes) {
-                        mapMsg (true, 1000, _FX("%s: copy failed"), title);
-                        goto out;
-                    }
-                    nbufbytes = 0;
+                // write
+                resetWatchdog();
+                updateClocks(false);
+                if (f.write (copy_buf, nbufbytes) != nbufbytes) {
+                    mapMsg (true, 1000, _FX("%s: copy failed"), title);
+                    goto out;
                 }
             }
-            Serial.printf (_FX("%s: %ld B/s\n"), title, 1000L*npixbytes/(millis()-t0));
+            if (pan_zoom.zoom > MIN_ZOOM)
+                mapMsg (want_msg, 0, _FX("%s %dx: %3d%%"), title, pan_zoom.zoom, 100);
+            else
+                mapMsg (want_msg, 0, _FX("%s: %3d%%"), title, 100);
+            Serial.printf (_FX("%s: %ld B/s\n"), title, 1000L*npixbytes/(millis()-t0+1));
         }
 
         // if get here, it worked!
@@ -246,7 +337,80 @@ static void invalidatePixels()
         }
 }
 
+/* decompress the given open HCZ file into a new anonymous mapping of nbytes laid out exactly like the
+ * BMP file from which it was made, so it may be used and unmapped just like a mmap'ed BMP file.
+ * bands are decoded one at a time as they are read so the whole compressed file is never in memory.
+ * return mapping else MAP_FAILED with errno set.
+ */
+static char *mmapZMapFile (File &f, const char *file, int nbytes)
+{
+        char hdr_buf[HCZ_HDRSZ+BHDRSZ];
+        uint32_t n_bands, band_rows;
+        if (!f.seek (0, SEEK_SET) || f.read ((uint8_t*)hdr_buf, sizeof(hdr_buf)) != sizeof(hdr_buf)
+                        || !zmapHdrOk (hdr_buf, ZOOM_W, ZOOM_H, &n_bands, &band_rows)) {
+            errno = EINVAL;
+            return ((char *)MAP_FAILED);
+        }
+
+        // room for entire BMP, writable only until decoding is complete
+        char *pixels = (char *) mmap (NULL, nbytes, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+        if (pixels == MAP_FAILED)
+            return (pixels);
+        memcpy (pixels, hdr_buf + HCZ_HDRSZ, BHDRSZ);
+
+        // read band sizes then decode each band in place
+        const uint32_t band_max = ZOOM_W*band_rows*BPERBMPPIX;
+        StackMalloc table_mem(4*n_bands);
+        StackMalloc band_mem(band_max);
+        char *table = (char *) table_mem.getMem();
+        uint8_t *band = (uint8_t *) band_mem.getMem();
+        if (f.read ((uint8_t*)table, 4*n_bands) != 4*n_bands
+                                    || zmapBandsSize (table, n_bands, ZOOM_W, band_rows) == 0) {
+            Serial.printf (_FX("%s: bad band table\n"), file);
+            goto bad;
+        }
+        for (uint32_t i = 0; i < n_bands; i++) {
+            uint8_t *band_pix = (uint8_t *) pixels + BHDRSZ + i*band_max;
+            uint32_t band_n = i < n_bands-1 ? band_max : (ZOOM_H - i*band_rows)*ZOOM_W*BPERBMPPIX;
+            uint32_t csize = unpackLE4 (table + 4*i);
+            if (csize >= band_n) {
+                // stored as is
+                if (csize != band_n || f.read (band_pix, band_n) != band_n) {
+                    Serial.printf (_FX("%s: band %u short\n"), file, i);
+                    goto bad;
+                }
+            } else if (f.read (band, csize) != csize
+                                || lz4Decompress (band, csize, band_pix, band_n) != (int)band_n) {
+                Serial.printf (_FX("%s: band %u corrupt\n"), file, i);
+                goto bad;
+            }
+        }
+
+        // now read-only like a file mapping
+        mprotect (pixels, nbytes, PROT_READ);
+        return (pixels);
+
+    bad:
+
+        munmap (pixels, nbytes);
+        errno = EINVAL;
+        return ((char *)MAP_FAILED);
+}
+
+/* map the pixels of the given open map file, decompressing first if it is HCZ.
+ * return mapping else MAP_FAILED with errno set.
+ */
+static char *mmapMapFile (File &f, const char *file, int nbytes)
+{
+        if (isZMapName (file))
+            return (mmapZMapFile (f, file, nbytes));
+
+        // allow OS to choose addr
+        return ((char *) mmap (NULL, nbytes, PROT_READ, MAP_PRIVATE, f.fileno(), 0));
+}
+
 /* prepare open day_file and night_file for pixel access.
+ * either file may be BMP or compressed HCZ according to its name.
  * return whether ok
  */
 static bool installFilePixels (const char *dfile, const char *nfile)
@@ -258,10 +422,8 @@ static bool installFilePixels (const char *dfile, const char *nfile)
 
             day_fbytes = BHDRSZ + ZOOM_W*ZOOM_H*2;          // n bytes of 16 bit RGB565 pixels
             night_fbytes = BHDRSZ + ZOOM_W*ZOOM_H*2;
-            day_pixels = (char *)                               // allow OS to choose addrs
-                    mmap (NULL, day_fbytes, PROT_READ, MAP_PRIVATE, day_file.fileno(), 0);
-            night_pixels = (char *)
-                    mmap (NULL, night_fbytes, PROT_READ, MAP_PRIVATE, night_file.fileno(), 0);
+            day_pixels = mmapMapFile (day_file, dfile, day_fbytes);
+            night_pixels = mmapMapFile (night_file, nfile, night_fbytes);
 
             ok = day_pixels != MAP_FAILED && night_pixels != MAP_FAILED;
         }
@@ -485,8 +647,9 @@ static bool crackLastModified (const char *line, time_t &time_val)
 }
 
 /* open the given file and confirm its size, downloading fresh if not found, no match or newer.
+ * file may be either BMP or compressed HCZ according to its name; since the server need not offer HCZ
+ * files, failing to find one is not reported as an error.
  * if successful return:
- *   with position offset at first pixel,
  *   indicate whether a file was downloaded,
  *   open LittleFS File
  * else return a closed File
@@ -504,8 +667,11 @@ static File openMapFile (bool *downloaded, const char *file, const char *title)
         uint32_t filesize;
         time_t local_time = 0;
         time_t remote_time = 0;
-        char hdr_buf[BHDRSZ];
-        int nr = 0;
+        char hdr_buf[HCZ_HDRSZ+BHDRSZ];
+        const bool zipped = isZMapName (file);
+        const uint32_t nhdrbytes = zipped ? HCZ_HDRSZ + BHDRSZ : BHDRSZ;
+        uint32_t n_bands = 0, band_rows = 0;
+        uint32_t nr = 0;
         bool file_ok = false;
 
         Serial.printf (_FX("%s: %s\n"), title, file);
@@ -517,7 +683,10 @@ static File openMapFile (bool *downloaded, const char *file, const char *title)
             char lm_str[50];
             if (!httpSkipHeader (client, _FX("Last-Modified:"), lm_str, sizeof(lm_str))
                                                 || !crackLastModified (lm_str, remote_time)) {
-                mapMsg (true, 1000, _FX("%s: network err - try local"), title);
+                if (zipped)
+                    Serial.printf (_FX("%s: no remote %s\n"), title, file);
+                else
+                    mapMsg (true, 1000, _FX("%s: network err - try local"), title);
                 client.stop();
             }
             Serial.printf (_FX("%s: %ld remote_time\n"), title, (long)remote_time);
@@ -541,14 +710,26 @@ static File openMapFile (bool *downloaded, const char *file, const char *title)
         }
 
         // read local file header
-        nr = f.read ((uint8_t*)hdr_buf, BHDRSZ);
-        if (nr != BHDRSZ) {
+        nr = f.read ((uint8_t*)hdr_buf, nhdrbytes);
+        if (nr != nhdrbytes) {
             mapMsg (true, 1000, _FX("%s: read err"), title);
             goto out;
         }
 
         // check flash file type and size
-        if (!bmpHdrOk (hdr_buf, ZOOM_W, ZOOM_H, &filesize)) {
+        if (zipped) {
+            if (!zmapHdrOk (hdr_buf, ZOOM_W, ZOOM_H, &n_bands, &band_rows)) {
+                mapMsg (true, 1000, _FX("%s: bad format"), title);
+                goto out;
+            }
+            StackMalloc table_mem(4*n_bands);
+            char *table = (char *) table_mem.getMem();
+            if (f.read ((uint8_t*)table, 4*n_bands) != 4*n_bands) {
+                mapMsg (true, 1000, _FX("%s: read err"), title);
+                goto out;
+            }
+            filesize = nhdrbytes + 4*n_bands + zmapBandsSize (table, n_bands, ZOOM_W, band_rows);
+        } else if (!bmpHdrOk (hdr_buf, ZOOM_W, ZOOM_H, &filesize)) {
             mapMsg (true, 1000, _FX("%s: bad format"), title);
             goto out;
         }
@@ -617,10 +798,23 @@ static bool installFileMaps()
             night_file.close();
         cleanupMaps (style);
 
-        // open each file, downloading if newer or not found locally
+        // open each file, downloading if newer or not found locally.
+        // prefer the compressed form but fall back to BMP if neither it nor the server has it.
         bool dd = false, nd = false;
-        day_file = openMapFile (&dd, dfile, dtitle);
-        night_file = openMapFile (&nd, nfile, ntitle);
+        char zdfile[LFS_NAME_MAX];
+        char znfile[LFS_NAME_MAX];
+        buildZMapName (dfile, zdfile);
+        buildZMapName (nfile, znfile);
+        day_file = openMapFile (&dd, zdfile, dtitle);
+        if (day_file)
+            strcpy (dfile, zdfile);
+        else
+            day_file = openMapFile (&dd, dfile, dtitle);
+        night_file = openMapFile (&nd, znfile, ntitle);
+        if (night_file)
+            strcpy (nfile, znfile);
+        else
+            night_file = openMapFile (&nd, nfile, ntitle);
 
         // install pixels
         if (installFilePixels (dfile, nfile)) {
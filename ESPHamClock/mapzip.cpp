@@ -0,0 +1,365 @@
+/* LZ4 block compression for background map files, plus a stand-alone tool to create them.
+ *
+ * An HCZ map file holds the same pixels as an RGB565 BMP V4 map file but compressed in bands of rows
+ * so it may be decoded as it streams. All values are little-endian:
+ *
+ *   HCZ_HDRSZ bytes:   "HCZ1", width, height, rows per band, n bands, each 4 bytes
+ *   HCZ_BMPHDRSZ:      the complete header of the original BMP file
+ *   4 * n bands:       compressed size of each band
+ *   n bands:           each band compressed with lz4Compress(), or stored as is if that is no smaller
+ *
+ * stand-alone tool to convert BMP map files to HCZ:
+ *    g++ -Wall -O2 -D_MAPZIP_TOOL -o bmp2hcz mapzip.cpp
+ *    ./bmp2hcz map-D-660x330-Countries.bmp ...
+ */
+
+
+/* use HamClock.h but if stand-alone tool then define here what we need from it
+ */
+
+#if defined (_MAPZIP_TOOL)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#define HCZ_MAGIC       "HCZ1"                  // first 4 bytes of every HCZ file
+#define HCZ_HDRSZ       20                      // bytes in HCZ header proper
+#define HCZ_BMPHDRSZ    122                     // bytes in original BMP header that follows
+#define HCZ_BANDROWS    32                      // rows per band written by this tool
+
+extern int lz4Compress (const uint8_t *src, int src_n, uint8_t *dst, int dst_max);
+extern int lz4Decompress (const uint8_t *src, int src_n, uint8_t *dst, int dst_n);
+
+#else // !_MAPZIP_TOOL
+
+#include "HamClock.h"
+
+#endif // !_MAPZIP_TOOL
+
+
+/* LZ4 block format limits
+ */
+#define LZ4_MINMATCH    4                       // shortest match
+#define LZ4_LASTLITS    5                       // last bytes are always literals
+#define LZ4_MFLIMIT     12                      // last match must start at least this far from end
+#define LZ4_MAXOFFSET   65535                   // farthest match
+#define LZ4_HASHBITS    14                      // log2 of n hash table entries
+
+
+/* unaligned little-endian 32 bit access
+ */
+static uint32_t read32 (const uint8_t *p)
+{
+    return ((uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24));
+}
+
+/* append an LZ4 length extension for the given remainder at dst[*opp], return whether it fit.
+ */
+static bool lz4PutLength (int len, uint8_t *dst, int *opp, int dst_max)
+{
+    for (; len >= 255; len -= 255) {
+        if (*opp >= dst_max)
+            return (false);
+        dst[(*opp)++] = 255;
+    }
+    if (*opp >= dst_max)
+        return (false);
+    dst[(*opp)++] = len;
+    return (true);
+}
+
+/* append one LZ4 sequence of n_lit literals at lit followed by a match of match_len at offset,
+ * or no match if match_len is 0. return whether it fit.
+ */
+static bool lz4PutSequence (const uint8_t *lit, int n_lit, int offset, int match_len,
+    uint8_t *dst, int *opp, int dst_max)
+{
+    // token
+    if (*opp >= dst_max)
+        return (false);
+    int ml = match_len ? match_len - LZ4_MINMATCH : 0;
+    uint8_t *token = &dst[(*opp)++];
+    *token = ((n_lit < 15 ? n_lit : 15) << 4) | (ml < 15 ? ml : 15);
+
+    // literals
+    if (n_lit >= 15 && !lz4PutLength (n_lit - 15, dst, opp, dst_max))
+        return (false);
+    if (*opp + n_lit > dst_max)
+        return (false);
+    memcpy (&dst[*opp], lit, n_lit);
+    *opp += n_lit;
+
+    // match
+    if (match_len) {
+        if (*opp + 2 > dst_max)
+            return (false);
+        dst[(*opp)++] = offset & 0xff;
+        dst[(*opp)++] = offset >> 8;
+        if (ml >= 15 && !lz4PutLength (ml - 15, dst, opp, dst_max))
+            return (false);
+    }
+
+    return (true);
+}
+
+/* compress src_n bytes at src into dst as one standard LZ4 block, using a simple greedy match finder.
+ * return compressed length, else -1 if it does not fit within dst_max.
+ */
+int lz4Compress (const uint8_t *src, int src_n, uint8_t *dst, int dst_max)
+{
+    int *htab = (int *) calloc (1 << LZ4_HASHBITS, sizeof(int));
+    if (!htab)
+        return (-1);
+
+    int op = 0;                                 // next dst index
+    int anchor = 0;                             // first src byte not yet emitted
+    bool ok = true;
+
+    if (src_n > LZ4_MFLIMIT) {
+        const int mf_limit = src_n - LZ4_MFLIMIT;
+        const int match_limit = src_n - LZ4_LASTLITS;
+        for (int ip = 0; ok && ip < mf_limit; ) {
+
+            // find previous position with same 4 bytes, if any, and replace with this one
+            uint32_t seq = read32 (&src[ip]);
+            uint32_t h = (seq * 2654435761U) >> (32 - LZ4_HASHBITS);
+            int ref = htab[h];
+            htab[h] = ip;
+            if (ref >= ip || ip - ref > LZ4_MAXOFFSET || read32 (&src[ref]) != seq) {
+                ip++;
+                continue;
+            }
+
+            // extend match as far as allowed
+            int len = LZ4_MINMATCH;
+            while (ip + len < match_limit && src[ref+len] == src[ip+len])
+                len++;
+
+            // emit pending literals and this match
+            ok = lz4PutSequence (&src[anchor], ip - anchor, ip - ref, len, dst, &op, dst_max);
+            ip += len;
+            anchor = ip;
+        }
+    }
+
+    // remaining literals
+    if (ok)
+        ok = lz4PutSequence (&src[anchor], src_n - anchor, 0, 0, dst, &op, dst_max);
+
+    free (htab);
+    return (ok ? op : -1);
+}
+
+/* decompress one LZ4 block of src_n bytes at src into exactly dst_n bytes at dst.
+ * return dst_n if ok, else -1 if src is corrupt or does not decode to exactly dst_n bytes.
+ */
+int lz4Decompress (const uint8_t *src, int src_n, uint8_t *dst, int dst_n)
+{
+    int ip = 0;
+    int op = 0;
+
+    while (ip < src_n) {
+
+        // literals
+        int token = src[ip++];
+        int n_lit = token >> 4;
+        if (n_lit == 15) {
+            int b;
+            do {
+                if (ip >= src_n)
+                    return (-1);
+                b = src[ip++];
+                n_lit += b;
+            } while (b == 255);
+        }
+        if (n_lit > src_n - ip || n_lit > dst_n - op)
+            return (-1);
+        memcpy (&dst[op], &src[ip], n_lit);
+        ip += n_lit;
+        op += n_lit;
+
+        // last sequence has no match
+        if (ip == src_n)
+            break;
+
+        // match
+        if (ip + 2 > src_n)
+            return (-1);
+        int offset = src[ip] | (src[ip+1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > op)
+            return (-1);
+        int len = (token & 15) + LZ4_MINMATCH;
+        if ((token & 15) == 15) {
+            int b;
+            do {
+                if (ip >= src_n)
+                    return (-1);
+                b = src[ip++];
+                len += b;
+            } while (b == 255);
+        }
+        if (len > dst_n - op)
+            return (-1);
+
+        // N.B. match may overlap what it is creating
+        const uint8_t *mp = &dst[op - offset];
+        if (offset >= len)
+            memcpy (&dst[op], mp, len);
+        else
+            for (int i = 0; i < len; i++)
+                dst[op+i] = mp[i];
+        op += len;
+    }
+
+    return (op == dst_n ? op : -1);
+}
+
+
+#if defined (_MAPZIP_TOOL)
+
+/* store v as 4 little-endian bytes at p
+ */
+static void write32 (uint8_t *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+/* convert the given BMP map file to HCZ in the same directory, then verify it decodes exactly.
+ * return whether ok.
+ */
+static bool convertBMP (const char *bmp_fn)
+{
+    bool ok = false;
+    FILE *fp = NULL;
+    uint8_t *bmp = NULL, *hcz = NULL, *check = NULL;
+    char hcz_fn[1000];
+    long bmp_n;
+    int w, h, n_bands, band_max, hcz_n, hdr_n;
+
+    // read entire BMP
+    fp = fopen (bmp_fn, "r");
+    if (!fp) {
+        printf ("%s: %s\n", bmp_fn, strerror(errno));
+        goto out;
+    }
+    fseek (fp, 0L, SEEK_END);
+    bmp_n = ftell (fp);
+    rewind (fp);
+    bmp = (uint8_t *) malloc (bmp_n);
+    if (!bmp || fread (bmp, 1, bmp_n, fp) != (size_t)bmp_n) {
+        printf ("%s: read error\n", bmp_fn);
+        goto out;
+    }
+    fclose (fp);
+    fp = NULL;
+
+    // confirm it is one of our RGB565 BMP V4 maps, rows stored top-down
+    w = read32 (&bmp[18]);
+    h = - (int) read32 (&bmp[22]);
+    if (bmp_n < HCZ_BMPHDRSZ || bmp[0] != 'B' || bmp[1] != 'M' || read32 (&bmp[14]) != 108
+                        || w <= 0 || h <= 0 || bmp_n != HCZ_BMPHDRSZ + 2L*w*h) {
+        printf ("%s: not an RGB565 BMP V4 map\n", bmp_fn);
+        goto out;
+    }
+
+    // compress each band after the header and size table
+    n_bands = (h + HCZ_BANDROWS - 1) / HCZ_BANDROWS;
+    band_max = 2*w*HCZ_BANDROWS;
+    hdr_n = HCZ_HDRSZ + HCZ_BMPHDRSZ + 4*n_bands;
+    hcz = (uint8_t *) malloc (hdr_n + bmp_n);           // stored bands can never be larger
+    if (!hcz) {
+        printf ("%s: no memory\n", bmp_fn);
+        goto out;
+    }
+    memcpy (hcz, HCZ_MAGIC, 4);
+    write32 (&hcz[4], w);
+    write32 (&hcz[8], h);
+    write32 (&hcz[12], HCZ_BANDROWS);
+    write32 (&hcz[16], n_bands);
+    memcpy (&hcz[HCZ_HDRSZ], bmp, HCZ_BMPHDRSZ);
+    hcz_n = hdr_n;
+    for (int i = 0; i < n_bands; i++) {
+        const uint8_t *band = &bmp[HCZ_BMPHDRSZ + i*band_max];
+        int band_n = i < n_bands-1 ? band_max : 2*w*(h - i*HCZ_BANDROWS);
+        int z_n = lz4Compress (band, band_n, &hcz[hcz_n], band_n - 1);
+        if (z_n < 0) {
+            memcpy (&hcz[hcz_n], band, band_n);
+            z_n = band_n;
+        }
+        write32 (&hcz[HCZ_HDRSZ + HCZ_BMPHDRSZ + 4*i], z_n);
+        hcz_n += z_n;
+    }
+
+    // verify every band decodes back exactly
+    check = (uint8_t *) malloc (band_max);
+    if (!check) {
+        printf ("%s: no memory\n", bmp_fn);
+        goto out;
+    }
+    for (int i = 0, z_os = hdr_n; i < n_bands; i++) {
+        const uint8_t *band = &bmp[HCZ_BMPHDRSZ + i*band_max];
+        int band_n = i < n_bands-1 ? band_max : 2*w*(h - i*HCZ_BANDROWS);
+        int z_n = read32 (&hcz[HCZ_HDRSZ + HCZ_BMPHDRSZ + 4*i]);
+        if (z_n == band_n)
+            memcpy (check, &hcz[z_os], band_n);
+        else if (lz4Decompress (&hcz[z_os], z_n, check, band_n) != band_n) {
+            printf ("%s: band %d does not decompress\n", bmp_fn, i);
+            goto out;
+        }
+        if (memcmp (check, band, band_n) != 0) {
+            printf ("%s: band %d does not match\n", bmp_fn, i);
+            goto out;
+        }
+        z_os += z_n;
+    }
+
+    // write alongside with .hcz suffix in place of .bmp
+    snprintf (hcz_fn, sizeof(hcz_fn), "%s", bmp_fn);
+    if (strlen(hcz_fn) > 4 && strcmp (hcz_fn + strlen(hcz_fn) - 4, ".bmp") == 0)
+        hcz_fn[strlen(hcz_fn)-4] = '\0';
+    strncat (hcz_fn, ".hcz", sizeof(hcz_fn) - strlen(hcz_fn) - 1);
+    fp = fopen (hcz_fn, "w");
+    if (!fp || fwrite (hcz, 1, hcz_n, fp) != (size_t)hcz_n || fclose (fp) != 0) {
+        printf ("%s: %s\n", hcz_fn, strerror(errno));
+        fp = NULL;
+        goto out;
+    }
+    fp = NULL;
+
+    printf ("%s: %ld -> %d bytes, %.1f%%\n", hcz_fn, bmp_n, hcz_n, 100.0*hcz_n/bmp_n);
+    ok = true;
+
+  out:
+
+    if (fp)
+        fclose (fp);
+    free (bmp);
+    free (hcz);
+    free (check);
+    return (ok);
+}
+
+int main (int ac, char *av[])
+{
+    if (ac < 2) {
+        fprintf (stderr, "Purpose: convert HamClock BMP map files to compressed HCZ files alongside\n");
+        fprintf (stderr, "Usage: %s file.bmp ...\n", av[0]);
+        return (1);
+    }
+
+    int n_bad = 0;
+    for (int i = 1; i < ac; i++)
+        if (!convertBMP (av[i]))
+            n_bad++;
+
+    return (n_bad > 0);
+}
+
+#endif // _MAPZIP_TOOL
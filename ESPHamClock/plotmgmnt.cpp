@@ -819,6 +819,11 @@ bool installBMP (WiFiClient &client, const SBox &box, char ynot[], size_t ynot_l
     uint16_t boxx_border = img_w < v_b.w ? (v_b.w - img_w)/2 : 0;
     uint16_t boxy_border = img_h < v_b.h ? (v_b.h - img_h)/2 : 0;
 
+    // each row is padded to a multiple of 4 bytes
+    int row_bytes = (3*img_w + 3) & ~3;
+    StackMalloc row_mem(row_bytes);
+    char *row = (char *) row_mem.getMem();
+
     // scan all pixels ...
     for (uint16_t img_y = 0; img_y < img_h; img_y++) {
 
@@ -826,48 +831,44 @@ bool installBMP (WiFiClient &client, const SBox &box, char ynot[], size_t ynot_l
         resetWatchdog();
         updateClocks(false);
 
-        for (uint16_t img_x = 0; img_x < img_w; img_x++) {
-
-            char b, g, r;
-
-            // read next pixel -- note order!
-            if (!getTCPChar (client, &b) || !getTCPChar (client, &g) || !getTCPChar (client, &r)) {
-                // allow a little loss because ESP TCP stack can fall behind while also drawing
-                int32_t n_draw = img_y*img_w + img_x;
-                if (n_draw > 9*n_pix/10) {
-                    // close enough
-                    Serial.printf (_FX("read error after %d pixels but good enough\n"), n_draw);
-                    break;
-                } else {
-                    Serial.printf (_FX("read error after %d pixels\n"), n_draw);
-                    snprintf (ynot, ynot_len, _FX("File is short"));
-                    return (false);
-                }
+        // read next row including padding
+        int n_read = getTCPBytes (client, row, row_bytes);
+        int row_pix = n_read < 3*img_w ? n_read/3 : img_w;
+        if (n_read < row_bytes) {
+            // allow a little loss because ESP TCP stack can fall behind while also drawing
+            int32_t n_draw = img_y*img_w + row_pix;
+            if (n_draw > 9*n_pix/10) {
+                // close enough
+                Serial.printf (_FX("read error after %d pixels but good enough\n"), n_draw);
+            } else if (row_pix == img_w) {
+                snprintf (ynot, ynot_len, _FX("Row padding error"));
+                return (false);
+            } else {
+                Serial.printf (_FX("read error after %d pixels\n"), n_draw);
+                snprintf (ynot, ynot_len, _FX("File is short"));
+                return (false);
             }
+        }
+
+        for (uint16_t img_x = 0; img_x < row_pix; img_x++) {
 
             // ... but only draw what fits inside box
             if (img_x > imgx_border && img_x < img_w - imgx_border - tft.SCALESZ
                         && img_y > imgy_border && img_y < img_h - imgy_border - tft.SCALESZ) {
 
-                uint8_t ur = r;
-                uint8_t ug = g;
-                uint8_t ub = b;
+                // note order!
+                uint8_t ub = row[3*img_x];
+                uint8_t ug = row[3*img_x+1];
+                uint8_t ur = row[3*img_x+2];
                 uint16_t color16 = RGB565(ur,ug,ub);
                 tft.drawPixelRaw (v_b.x + boxx_border + img_x - imgx_border,
                         v_b.y + v_b.h - (boxy_border + img_y - imgy_border) - 1, color16); // vertical flip
             }
         }
 
-        // skip padding to bring total row length to multiple of 4
-        uint8_t extra = img_w % 4;
-        if (extra > 0) {
-            for (uint8_t i = 0; i < 4 - extra; i++) {
-                if (!getTCPChar(client,&c)) {
-                    snprintf (ynot, ynot_len, _FX("Row padding error"));
-                    return (false);
-                }
-            }
-        }
+        // done if short
+        if (n_read < row_bytes)
+            break;
     }
 
     // finally!
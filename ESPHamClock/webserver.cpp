@@ -3988,6 +3988,72 @@ static bool roCommandOk (const char *cmd)
                     || strncmp_P (cmd, PSTR("set_screenlock"), 14) == 0);
 }
 
+/* O(1) command lookup: command_table indices hashed on each command string through its trailing ? or
+ * blank, with linear probing. slots hold index + 1 so 0 marks an empty slot.
+ * N.B. only the first of several entries with the same command string is found, which is all the
+ *      repeated set_time? entries need.
+ */
+#define CT_HASH_N       128                             // power of 2 comfortably larger than N_CMDTABLE
+static uint8_t ct_hash[CT_HASH_N];
+
+/* return FNV-1a hash of cmd through its first ? or blank and set *len to its length including same.
+ * return 0 with *len 0 if there is no such terminator within CT_MAX_CMD.
+ */
+static uint32_t hashCommand (const char *cmd, int *len)
+{
+    uint32_t h = 2166136261U;
+    for (int i = 0; i < CT_MAX_CMD-1 && cmd[i] != '\0'; i++) {
+        h = (h ^ (uint8_t)cmd[i]) * 16777619U;
+        if (cmd[i] == '?' || cmd[i] == ' ') {
+            *len = i + 1;
+            return (h);
+        }
+    }
+    *len = 0;
+    return (0);
+}
+
+/* fill ct_hash from command_table.
+ */
+static void buildCommandHash()
+{
+    for (int i = 0; i < N_CMDTABLE; i++) {
+        char ramcmd[CT_MAX_CMD];
+        strcpy_P (ramcmd, command_table[i].command);
+        int len;
+        uint32_t h = hashCommand (ramcmd, &len);
+        if (len == 0)
+            fatalError ("RESTful command %s lacks ? or blank", ramcmd);
+        for (uint32_t j = h; ; j++) {
+            uint8_t *slotp = &ct_hash[j & (CT_HASH_N-1)];
+            if (*slotp == 0) {
+                *slotp = i + 1;
+                break;
+            }
+            if (strcmp_P (ramcmd, command_table[*slotp-1].command) == 0)
+                break;                                  // keep first of duplicates
+        }
+    }
+}
+
+/* return command_table entry whose command string begins the given command, else NULL.
+ */
+static const CmdTble *findCommand (const char *command)
+{
+    int len;
+    uint32_t h = hashCommand (command, &len);
+    if (len == 0)
+        return (NULL);
+    for (uint32_t j = h; ; j++) {
+        uint8_t slot = ct_hash[j & (CT_HASH_N-1)];
+        if (slot == 0)
+            return (NULL);
+        const CmdTble *ctp = &command_table[slot-1];
+        if (strlen_P (ctp->command) == (size_t)len && strncmp_P (command, ctp->command, len) == 0)
+            return (ctp);
+    }
+}
+
 /* run the given web server command.
  * send ack or error messages to client.
  * return strictly whether command was recognized, regardless of whether it returned an error.
@@ -3998,32 +4064,30 @@ static bool runWebserverCommand (WiFiClient &client, bool ro, char *command, siz
     // search for command depending on context, execute its implementation function if found
     if (!ro || roCommandOk (command)) {
         resetWatchdog();
-        for (int i = 0; i < N_CMDTABLE; i++) {
-            const CmdTble *ctp = &command_table[i];
+        const CmdTble *ctp = findCommand (command);
+        if (ctp) {
             int cmd_len = strlen_P (ctp->command);
-            if (strncmp_P (command, ctp->command, cmd_len) == 0) {
 
-                // found command, skip to params immediately following
-                char *params = command+cmd_len;
+            // found command, skip to params immediately following
+            char *params = command+cmd_len;
 
-                // replace any %XX encoded values
-                if (replaceEncoding (params))
-                    Serial.printf (_FX("Decoded: %s\n"), params);      // print decoded version
+            // replace any %XX encoded values
+            if (replaceEncoding (params))
+                Serial.printf (_FX("Decoded: %s\n"), params);      // print decoded version
 
-                // chop off trailing HTTP _after_ looking for commands because get_ commands end with blank.
-                char *http = strstr (params, " HTTP");
-                if (http)
-                    *http = '\0';
+            // chop off trailing HTTP _after_ looking for commands because get_ commands end with blank.
+            char *http = strstr (params, " HTTP");
+            if (http)
+                *http = '\0';
 
-                // run handler, passing string starting right after the command, reply with error if trouble.
-                resetWatchdog();
-                PCTF funp = CT_FUNP(ctp);
-                if (!(*funp)(client, params, max_cmd_len - cmd_len))
-                    sendHTTPError (client, _FX("%.*s error: %s\n"), cmd_len, command, params);
+            // run handler, passing string starting right after the command, reply with error if trouble.
+            resetWatchdog();
+            PCTF funp = CT_FUNP(ctp);
+            if (!(*funp)(client, params, max_cmd_len - cmd_len))
+                sendHTTPError (client, _FX("%.*s error: %s\n"), cmd_len, command, params);
 
-                // command found, even if it reported an error
-                return (true);
-            }
+            // command found, even if it reported an error
+            return (true);
         }
     }
 
@@ -4041,59 +4105,70 @@ static bool isPOST (const char *line)
             || strncmp (line, _FX("POST /set_bmp?"), 14) == 0);
 }
 
-/* service remote restful connection.
- * if ro, only accept the get commands and a few more as listed in roCommandOk().
- * N.B. caller must close client, we don't.
+/* read the RESTful query line from client into line[] and skip the remainder of the header,
+ * returning Content-Length, if any, in *clp.
+ * return whether ok, else ynot[] is a reason worth sending back to client or empty if hopeless.
+ * N.B. we do not reply to client ourselves so this is safe to call from any thread.
  */
-static void serveRemote(WiFiClient &client, bool ro)
+static bool readRemoteQuery (WiFiClient &client, char line[], size_t line_len, long *clp,
+    char ynot[], size_t ynot_len)
 {
-    StackMalloc line_mem(TLE_LINEL*4);          // accommodate longest query, probably set_sattle with %20s
-    char *line = (char *) line_mem.getMem();    // handy access to malloced buffer
+    ynot[0] = '\0';
 
     // read query
-    if (!getTCPLine (client, line, line_mem.getSize(), NULL)) {
-        sendHTTPError (client, _FX("empty RESTful query\n"));
-        return;
+    if (!getTCPLine (client, line, line_len, NULL)) {
+        snprintf (ynot, ynot_len, _FX("empty RESTful query\n"));
+        return (false);
     }
 
     // first line must be the GET except a few can be POST
     if (strncmp (line, _FX("GET /"), 5) && !isPOST (line)) {
         Serial.println (line);
-        sendHTTPError (client, _FX("Method must be GET or POST\n"));
-        return;
+        snprintf (ynot, ynot_len, _FX("Method must be GET or POST\n"));
+        return (false);
     }
     // Serial.printf ("web: %s\n", line);
 
     // discard remainder of header, but capture content length if available
-    content_length = 0;
+    *clp = 0;
     char cl_str[20];
     if (httpSkipHeader (client, _FX("Content-Length:"), cl_str, sizeof(cl_str)))
-        content_length = atol (cl_str);
+        *clp = atol (cl_str);
     else {
         Serial.printf (_FX("bogus header after %s\n"), line);
-        return;
+        return (false);
     }
 
     // log sender
     Serial.printf (_FX("Command from %s: %s\n"), client.remoteIP().toString().c_str(), line);
-    if (content_length)
-        Serial.printf (_FX("Content-Length: %ld\n"), content_length);
+    if (*clp)
+        Serial.printf (_FX("Content-Length: %ld\n"), *clp);
 
+    // ok
+    return (true);
+}
+
+/* run the query in line[], as read by readRemoteQuery(), sending all replies to client.
+ * if ro, only accept the get commands and a few more as listed in roCommandOk().
+ * N.B. caller must close client, we don't.
+ */
+static void runRemoteQuery (WiFiClient &client, bool ro, char line[], size_t line_size)
+{
     // find beginning just after first -- we aleady know there is a /
     char *cmd_start = strchr (line,'/')+1;
 
     // run command
-    if (runWebserverCommand (client, ro, cmd_start, line + line_mem.getSize() - cmd_start))
+    if (runWebserverCommand (client, ro, cmd_start, line + line_size - cmd_start))
         return;
 
     // if get here, command was not found but client is still open to list help
     startPlainText(client);
     if (liveweb_rw_port > 0) {
-        snprintf (line, line_mem.getSize(), "HamClock Live is R/W on port %d\r\n\r\n", liveweb_rw_port);
+        snprintf (line, line_size, "HamClock Live is R/W on port %d\r\n\r\n", liveweb_rw_port);
         client.print (line);
     }
     if (liveweb_ro_port > 0) {
-        snprintf (line, line_mem.getSize(), "HamClock Live is R/O on port %d\r\n\r\n", liveweb_ro_port);
+        snprintf (line, line_size, "HamClock Live is R/O on port %d\r\n\r\n", liveweb_ro_port);
         client.print (line);
     }
     for (uint8_t i = 0; i < N_CMDTABLE-N_UNDOC_CMD; i++) {
@@ -4109,7 +4184,7 @@ static void serveRemote(WiFiClient &client, bool ro)
         const int indent = 22;
         int cmd_len = strlen (ramcmd);
         client.print (ramcmd);
-        snprintf (line, line_mem.getSize(), "%*s", indent-cmd_len, "");
+        snprintf (line, line_size, "%*s", indent-cmd_len, "");
         client.print (line);
         client.println (FPSTR(ctp->help));
 
@@ -4122,8 +4197,8 @@ static void serveRemote(WiFiClient &client, bool ro)
             for (int i = 0; i < PLOT_CH_N; i++) {
                 if (plotChoiceIsAvailable ((PlotChoice)i)) {
                     if (ll == 0)
-                        ll = snprintf (line, line_mem.getSize(), "%s", indent);
-                    ll += snprintf (line+ll, line_mem.getSize()-ll, " %s", plot_names[i]);
+                        ll = snprintf (line, line_size, "%s", indent);
+                    ll += snprintf (line+ll, line_size-ll, " %s", plot_names[i]);
                     if (ll > max_w) {
                         client.println (line);
                         ll = 0;
@@ -4135,6 +4210,323 @@ static void serveRemote(WiFiClient &client, bool ro)
     }
 }
 
+#if defined(_IS_UNIX)
+
+/* on UNIX the RESTful server runs in its own threads so slow clients no longer stall the main loop.
+ * restfulAcceptThread() queues each new connection for a pool of REST_NWORKERS restfulWorkerThread()s.
+ * A worker reads the query then queues a RESTJob for the main loop to run in checkWebServer(), which
+ * captures the reply in memory for the worker to send. Replies to get_ commands are also kept as
+ * snapshots that workers send again without involving the main loop until they are REST_SNAP_MS old.
+ * POSTs and the commands that do not return are run by the main loop directly on the client.
+ */
+#define REST_NWORKERS   4                               // n worker threads
+#define REST_NCONNQ     16                              // max connections waiting for a worker
+#define REST_SNAP_MS    1000                            // max age of a get_ snapshot, millis
+#define REST_JOBTO_MS   30000                           // max wait for main loop to start a job, millis
+
+typedef struct {
+    int refs;                                           // n users, free when 0
+    uint32_t t0;                                        // millis() when captured
+    size_t len;                                         // n bytes in reply
+    char *reply;                                        // complete HTTP reply, malloced
+} RESTSnap;
+
+typedef enum {
+    RJ_QUEUED,                                          // waiting in rest_jobs
+    RJ_RUNNING,                                         // being run by checkWebServer()
+    RJ_DONE,                                            // finished, snap is ready unless direct
+} RESTJobState;
+
+typedef struct _RESTJob {
+    struct _RESTJob *next;                              // next newer job in rest_jobs
+    RESTJobState state;                                 // progress
+    char *line;                                         // query as read by readRemoteQuery()
+    size_t line_size;                                   // total size of line[]
+    long content_length;                                // from query header
+    int snap_i;                                         // command_table index to publish as snapshot, or -1
+    WiFiClient *direct;                                 // run directly on this client if not NULL
+    RESTSnap *snap;                                     // captured reply if not direct
+} RESTJob;
+
+static WiFiClient rest_connq[REST_NCONNQ];              // connections waiting for a worker, oldest first
+static int rest_nconnq;                                 // n in rest_connq[]
+static RESTJob *rest_jobs;                              // jobs for main loop, oldest first
+static RESTSnap *rest_snaps[N_CMDTABLE];                // latest reply to each get_ command, if any
+static pthread_mutex_t rest_lock = PTHREAD_MUTEX_INITIALIZER;   // guards all rest_ variables
+static pthread_cond_t rest_connq_cv = PTHREAD_COND_INITIALIZER; // signaled when rest_connq grows
+static pthread_cond_t rest_done_cv = PTHREAD_COND_INITIALIZER;  // broadcast when any job is done
+
+/* send a minimal reply to client with the given HTTP status and plain text message.
+ * N.B. unlike sendHTTPError this is safe to call from any thread.
+ */
+static void sendHTTPStatus (WiFiClient &client, const char *status, const char *msg)
+{
+    char buf[300];
+    snprintf (buf, sizeof(buf),
+            "HTTP/1.0 %s\r\n"
+            "Content-Type: text/plain; charset=us-ascii\r\n"
+            "Connection: close\r\n"
+            "\r\n"
+            "%s", status, msg);
+    client.print (buf);
+}
+
+/* drop one reference to snap, freeing it when no longer used.
+ * N.B. caller must hold rest_lock
+ */
+static void releaseRESTSnap (RESTSnap *snap)
+{
+    if (snap && --snap->refs == 0) {
+        free (snap->reply);
+        free (snap);
+    }
+}
+
+/* return command_table index of the given command if its reply may be shared as a snapshot, else -1.
+ */
+static int snapIndex (const char *command)
+{
+    if (strncmp (command, "get_", 4) != 0)
+        return (-1);
+    const CmdTble *ctp = findCommand (command);
+    if (!ctp)
+        return (-1);
+    return (ctp - command_table);
+}
+
+/* return whether the given query must be run by the main loop directly on the client because it
+ * reads a POST body or does not return.
+ */
+static bool runsDirect (const char *line)
+{
+    if (isPOST (line))
+        return (true);
+    const CmdTble *ctp = findCommand (strchr (line,'/')+1);
+    if (!ctp)
+        return (false);
+    PCTF funp = CT_FUNP(ctp);
+    return (funp == doWiFiExit || funp == doWiFiReboot || funp == doWiFiUpdate);
+}
+
+/* read and reply to one RESTful client, from a worker thread.
+ * N.B. we close client
+ */
+static void serveRemoteThreaded (WiFiClient &client)
+{
+    StackMalloc line_mem(TLE_LINEL*4);          // accommodate longest query, probably set_sattle with %20s
+    char *line = (char *) line_mem.getMem();    // handy access to malloced buffer
+
+    // read query
+    long cl;
+    char ynot[100];
+    if (!readRemoteQuery (client, line, line_mem.getSize(), &cl, ynot, sizeof(ynot))) {
+        if (ynot[0]) {
+            Serial.print (ynot);
+            sendHTTPStatus (client, "400 Bad request", ynot);
+        }
+        client.stop();
+        return;
+    }
+    int snap_i = snapIndex (strchr (line,'/')+1);
+
+    pthread_mutex_lock (&rest_lock);
+
+    // use a fresh snapshot if possible, else have main loop run the query
+    RESTSnap *snap = NULL;
+    if (snap_i >= 0 && rest_snaps[snap_i] && millis() - rest_snaps[snap_i]->t0 < REST_SNAP_MS) {
+        snap = rest_snaps[snap_i];
+        snap->refs++;
+    } else {
+
+        // append new job
+        RESTJob job;
+        memset (&job, 0, sizeof(job));
+        job.state = RJ_QUEUED;
+        job.line = line;
+        job.line_size = line_mem.getSize();
+        job.content_length = cl;
+        job.snap_i = snap_i;
+        job.direct = runsDirect (line) ? &client : NULL;
+        RESTJob **jpp = &rest_jobs;
+        while (*jpp)
+            jpp = &(*jpp)->next;
+        *jpp = &job;
+
+        // wait for main loop to finish it, but only wait so long for it to start
+        struct timespec to;
+        clock_gettime (CLOCK_REALTIME, &to);
+        to.tv_sec += REST_JOBTO_MS/1000;
+        while (job.state != RJ_DONE) {
+            if (pthread_cond_timedwait (&rest_done_cv, &rest_lock, &to) == ETIMEDOUT
+                                                            && job.state == RJ_QUEUED) {
+                for (jpp = &rest_jobs; *jpp != &job; jpp = &(*jpp)->next)
+                    continue;
+                *jpp = job.next;
+                break;
+            }
+        }
+
+        if (job.state == RJ_QUEUED) {
+            pthread_mutex_unlock (&rest_lock);
+            Serial.printf (_FX("RESTful: main loop too busy for %s\n"), line);
+            sendHTTPStatus (client, "503 Service Unavailable", "HamClock is too busy, try again later\n");
+            client.stop();
+            return;
+        }
+
+        snap = job.snap;                                // already counts us if not NULL
+    }
+
+    pthread_mutex_unlock (&rest_lock);
+
+    // send reply if captured
+    if (snap) {
+        client.write ((const uint8_t *) snap->reply, snap->len);
+        pthread_mutex_lock (&rest_lock);
+        releaseRESTSnap (snap);
+        pthread_mutex_unlock (&rest_lock);
+    }
+
+    client.stop();
+}
+
+/* thread that serves each RESTful connection from rest_connq, forever
+ */
+static void *restfulWorkerThread (void *unused)
+{
+    (void) unused;
+
+    // detach so our resources are freed if we ever exit
+    pthread_detach (pthread_self());
+
+    while (true) {
+
+        // wait for next connection
+        pthread_mutex_lock (&rest_lock);
+        while (rest_nconnq == 0)
+            pthread_cond_wait (&rest_connq_cv, &rest_lock);
+        WiFiClient client = rest_connq[0];
+        memmove (&rest_connq[0], &rest_connq[1], (--rest_nconnq) * sizeof(rest_connq[0]));
+        pthread_mutex_unlock (&rest_lock);
+
+        // serve it
+        serveRemoteThreaded (client);
+    }
+
+    return (NULL);
+}
+
+/* thread that accepts each new RESTful connection and queues it for the workers, forever
+ */
+static void *restfulAcceptThread (void *unused)
+{
+    (void) unused;
+
+    // detach so our resources are freed if we ever exit
+    pthread_detach (pthread_self());
+
+    while (true) {
+
+        // block until next connection
+        WiFiClient client = restful_server->next();
+        if (!client) {
+            usleep (100000);                    // don't spin if something is seriously wrong
+            continue;
+        }
+
+        // queue for next worker unless already too many waiting
+        pthread_mutex_lock (&rest_lock);
+        bool full = rest_nconnq == REST_NCONNQ;
+        if (!full) {
+            rest_connq[rest_nconnq++] = client;
+            pthread_cond_signal (&rest_connq_cv);
+        }
+        pthread_mutex_unlock (&rest_lock);
+
+        if (full) {
+            Serial.printf (_FX("RESTful: dropping %s, %d already waiting\n"),
+                                client.remoteIP().toString().c_str(), REST_NCONNQ);
+            sendHTTPStatus (client, "503 Service Unavailable", "Too many RESTful connections, try again later\n");
+            client.stop();
+        }
+    }
+
+    return (NULL);
+}
+
+/* run the oldest query queued by the RESTful workers, if any.
+ * N.B. all such commands bypass the password system.
+ */
+void checkWebServer(bool ro)
+{
+    // handlers may call back here, eg via wdDelay(), but jobs are run strictly one at a time
+    static bool running;
+    if (running)
+        return;
+
+    // claim oldest job, if any
+    pthread_mutex_lock (&rest_lock);
+    RESTJob *job = rest_jobs;
+    if (job) {
+        rest_jobs = job->next;
+        job->state = RJ_RUNNING;
+    }
+    pthread_mutex_unlock (&rest_lock);
+    if (!job)
+        return;
+
+    // run it, capturing the reply unless direct
+    RESTSnap *snap = NULL;
+    running = true;
+    bypass_pw = true;
+    content_length = job->content_length;
+    if (job->direct) {
+        runRemoteQuery (*job->direct, ro, job->line, job->line_size);
+    } else {
+        WiFiClient capture;
+        capture.captureOutput (true);
+        runRemoteQuery (capture, ro, job->line, job->line_size);
+        snap = (RESTSnap *) calloc (1, sizeof(RESTSnap));
+        if (!snap)
+            fatalError ("No memory for RESTful reply");
+        snap->reply = capture.getCapture (snap->len);
+        snap->t0 = millis();
+        snap->refs = 1;                                 // for the worker
+    }
+    bypass_pw = false;
+    running = false;
+
+    // hand back to worker and publish as snapshot if appropriate
+    pthread_mutex_lock (&rest_lock);
+    if (snap && job->snap_i >= 0) {
+        releaseRESTSnap (rest_snaps[job->snap_i]);
+        rest_snaps[job->snap_i] = snap;
+        snap->refs++;
+    }
+    job->snap = snap;
+    job->state = RJ_DONE;
+    pthread_cond_broadcast (&rest_done_cv);
+    pthread_mutex_unlock (&rest_lock);
+}
+
+#else // !_IS_UNIX
+
+/* service remote restful connection.
+ * if ro, only accept the get commands and a few more as listed in roCommandOk().
+ * N.B. caller must close client, we don't.
+ */
+static void serveRemote(WiFiClient &client, bool ro)
+{
+    StackMalloc line_mem(TLE_LINEL*4);          // accommodate longest query, probably set_sattle with %20s
+    char *line = (char *) line_mem.getMem();    // handy access to malloced buffer
+
+    char ynot[100];
+    if (readRemoteQuery (client, line, line_mem.getSize(), &content_length, ynot, sizeof(ynot)))
+        runRemoteQuery (client, ro, line, line_mem.getSize());
+    else if (ynot[0])
+        sendHTTPError (client, "%s", ynot);
+}
+
 /* check if someone is trying to tell/ask us something.
  * N.B, all such commands bypass the password system.
  */
@@ -4151,6 +4543,8 @@ void checkWebServer(bool ro)
     }
 }
 
+#endif // _IS_UNIX
+
 /* call to start restful server unless disabled.
  * report ok with tftMsg but fatalError if trouble.
  */
@@ -4158,6 +4552,8 @@ void initWebServer()
 {
     resetWatchdog();
 
+    buildCommandHash();
+
     if (restful_port < 0) {
         tftMsg (true, 0, "RESTful API service is disabled");
         return;
@@ -4169,6 +4565,16 @@ void initWebServer()
     if (!restful_server->begin(ynot))
         fatalError ("Failed to start RESTful server on port %d: %s", restful_port, ynot);
 
+#if defined(_IS_UNIX)
+    // start the threads that serve it
+    pthread_t tid;
+    int e = pthread_create (&tid, NULL, restfulAcceptThread, NULL);
+    for (int i = 0; e == 0 && i < REST_NWORKERS; i++)
+        e = pthread_create (&tid, NULL, restfulWorkerThread, NULL);
+    if (e != 0)
+        fatalError ("Failed to start RESTful server threads: %s", strerror(e));
+#endif // _IS_UNIX
+
     tftMsg (true, 0, "RESTful API server on port %d", restful_port);
 
 }
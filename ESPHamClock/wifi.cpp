@@ -1644,6 +1644,14 @@ time_t getNTPUTC(const char **server)
  */
 bool getTCPChar (WiFiClient &client, char *cp)
 {
+#if defined(_IS_UNIX)
+    // UNIX WiFiClient can block efficiently
+    if (!client.waitAvailable (10000)) {
+        if (client.connected())
+            Serial.print (F("getTCPChar timeout\n"));
+        return (false);
+    }
+#else
     // wait for char, avoid calling millis() if more data are already ready
     if (!client.available()) {
         uint32_t t0 = millis();
@@ -1663,6 +1671,7 @@ bool getTCPChar (WiFiClient &client, char *cp)
             resetWatchdog();
         }
     }
+#endif
 
     // read, which offers yet another way to indicate failure
     int c = client.read();
@@ -1676,6 +1685,27 @@ bool getTCPChar (WiFiClient &client, char *cp)
     return (true);
 }
 
+/* read exactly n bytes from client into buf unless the connection closes or stalls for 10 seconds.
+ * return the number actually read, so < n means trouble.
+ */
+int getTCPBytes (WiFiClient &client, char *buf, int n)
+{
+#if defined(_IS_UNIX)
+    // UNIX WiFiClient can copy directly from its read-ahead buffer
+    int n_read = 0;
+    while (n_read < n && client.waitAvailable (10000))
+        n_read += client.read ((uint8_t *)buf + n_read, n - n_read);
+    if (n_read < n && client.connected())
+        Serial.print (F("getTCPBytes timeout\n"));
+    return (n_read);
+#else
+    int n_read = 0;
+    while (n_read < n && getTCPChar (client, &buf[n_read]))
+        n_read++;
+    return (n_read);
+#endif
+}
+
 /* send User-Agent to client
  */
 void sendUserAgent (WiFiClient &client)
@@ -1866,10 +1896,19 @@ static void httpGET (WiFiClient &client, const char *server, const char *page)
 {
     resetWatchdog();
 
+#if defined(_IS_UNIX)
+    // UNIX WiFiClient decodes HTTP/1.1 replies and reuses connections, see httpSkipHeader()
+    client.beginHTTPRequest();
+    FWIFIPR (client, F("GET ")); client.print(page); FWIFIPRLN (client, F(" HTTP/1.1"));
+    FWIFIPR (client, F("Host: ")); client.println (server);
+    sendUserAgent (client);
+    FWIFIPRLN (client, F("Connection: keep-alive\r\n"));
+#else
     FWIFIPR (client, F("GET ")); client.print(page); FWIFIPRLN (client, F(" HTTP/1.0"));
     FWIFIPR (client, F("Host: ")); client.println (server);
     sendUserAgent (client);
     FWIFIPRLN (client, F("Connection: close\r\n"));
+#endif
 
     resetWatchdog();
 }
@@ -1907,6 +1946,14 @@ bool httpSkipHeader (WiFiClient &client, const char *header, char *value, int va
         value[0] = '\0';
     char *hdr;
 
+#if defined(_IS_UNIX)
+    // collect body framing for HTTP/1.1 replies
+    long content_length = -1;
+    bool chunked = false;
+    bool keep_alive = false;
+    bool first_line = true;
+#endif
+
     // read until find a blank line
     do {
         if (!getTCPLine (client, line, sizeof(line), NULL))
@@ -1916,8 +1963,36 @@ bool httpSkipHeader (WiFiClient &client, const char *header, char *value, int va
         if (header && value && (hdr = strstr (line, header)) != NULL)
             snprintf (value, value_len, "%s", hdr + hdr_len);
 
+#if defined(_IS_UNIX)
+        if (first_line) {
+            // status line: 1.1 defaults to keep-alive, and some replies never have a body
+            int code = 0;
+            if (sscanf (line, "HTTP/1.%*d %d", &code) == 1) {
+                keep_alive = strncmp (line, "HTTP/1.1", 8) == 0;
+                if (code/100 == 1 || code == 204 || code == 304)
+                    content_length = 0;
+            }
+            first_line = false;
+        } else if (strncasecmp (line, "Content-Length:", 15) == 0) {
+            if (content_length != 0)
+                content_length = atol (line+15);
+        } else if (strncasecmp (line, "Transfer-Encoding:", 18) == 0) {
+            chunked = strcasestr (line+18, "chunked") != NULL;
+        } else if (strncasecmp (line, "Connection:", 11) == 0) {
+            if (strcasestr (line+11, "close"))
+                keep_alive = false;
+            else if (strcasestr (line+11, "keep-alive"))
+                keep_alive = true;
+        }
+#endif
+
     } while (line[0] != '\0');  // getTCPLine absorbs \r\n so this tests for a blank line
 
+#if defined(_IS_UNIX)
+    // no-op unless client sent the request with httpGET()
+    client.beginHTTPBody (content_length, chunked, keep_alive);
+#endif
+
     return (true);
 }
 
@@ -2411,6 +2486,15 @@ static bool updateRSS ()
  */
 bool getTCPLine (WiFiClient &client, char line[], uint16_t line_len, uint16_t *ll)
 {
+#if defined(_IS_UNIX)
+    // UNIX WiFiClient can scan its read-ahead buffer directly
+    int n = client.readLine (line, line_len, 10000);
+    if (n < 0)
+        return (false);
+    if (ll)
+        *ll = n;
+    return (true);
+#else
     // update network stack
     yield();
 
@@ -2434,6 +2518,7 @@ bool getTCPLine (WiFiClient &client, char line[], uint16_t line_len, uint16_t *l
         } else if (i < line_len)
             line[i++] = c;
     }
+#endif
 }
 
 /* convert an array of 4 big-endian network-order bytes into a uint32_t